@@ -34,6 +34,7 @@ The OSC webpage is http://opensoundcontrol.org/
 
 //#define DEBUG 1
 #define SC_BUFFER_SIZE 64000
+#define PACKOSC_CACHE_SIZE 256 /* number of slots in the address cache, must be a power of 2 */
 
 #include "packingOSC.h"
 #include "OSC_timeTag.h"
@@ -91,6 +92,7 @@ typedef struct OSCbuf_struct
                 /* currently-being-written message */
     uint32_t    *prevCounts[MAX_BUNDLE_NESTING]; /* Pointers to count */
                 /* field before each currently open bundle */
+    OSCTimeTag  timeTags[MAX_BUNDLE_NESTING]; /* time tag of each currently open bundle */
     int         bundleDepth; /* How many sub-sub-bundles are we in now? */
     char        *typeStringPtr; /* This pointer advances through the type */
                 /* tag string as you add arguments. */
@@ -100,12 +102,19 @@ typedef struct OSCbuf_struct
 
 typedef struct
 {
-    enum {INT_osc, FLOAT_osc, STRING_osc, BLOB_osc, NOTYPE_osc} type;
+    enum {INT_osc, FLOAT_osc, STRING_osc, BLOB_osc, INT64_osc, DOUBLE_osc, NOTYPE_osc} type;
     union
     {
         int   i;
         float f;
         const char  *s;
+        uint64_t h; /* h, or t as seconds and fraction */
+        double d;
+        struct
+        {
+            const t_atom *argv; /* the bytes of a blob, already checked */
+            int n;
+        } b;
     } datum;
 } typedArg;
 
@@ -166,12 +175,12 @@ static int OSC_CheckOverflow(void *x, const OSCbuf *buf, size_t bytesNeeded);
       does not have to have a bundle; it can instead consist of just a
       single message.
     - For each message you want to send:
-      - Call OSC_writeAddress() with the name of your message.  (In
-        addition to writing your message name into the buffer, this
+      - Call OSC_writeAddress() with the already padded name of your message.
+        (In addition to writing your message name into the buffer, this
         procedure will also leave space for the size count of this message.)
-      - Alternately, call OSC_writeAddressAndTypes() with the name of
-        your message and with a type string listing the types of all the
-        arguments you will be putting in this message.
+      - Alternately, call OSC_writeAddressAndTypes() with the padded name
+        of your message followed by a padded type string listing the types
+        of all the arguments you will be putting in this message.
       - Now write each of the arguments into the buffer, by calling one of:
         OSC_writeFloatArg()
         OSC_writeIntArg()
@@ -183,11 +192,11 @@ static int OSC_CheckOverflow(void *x, const OSCbuf *buf, size_t bytesNeeded);
 
 static int OSC_openBundle(void *x, OSCbuf *buf, OSCTimeTag tt);
 static int OSC_closeBundle(void *x, OSCbuf *buf);
-static int OSC_writeAddress(void *x, OSCbuf *buf, char *name);
-static int OSC_writeAddressAndTypes(void *x, OSCbuf *buf, char *name, char *types);
+static int OSC_writeAddress(void *x, OSCbuf *buf, const char *padded, int paddedLength);
+static int OSC_writeAddressAndTypes(void *x, OSCbuf *buf, const char *padded, int addressLength, int paddedLength);
 static int OSC_writeFloatArg(void *x, OSCbuf *buf, float arg);
 static int OSC_writeIntArg(void *x, OSCbuf *buf, uint32_t arg);
-static int OSC_writeBlobArg(void *x, OSCbuf *buf, typedArg *arg, size_t nArgs);
+static int OSC_writeBlobArg(void *x, OSCbuf *buf, const t_atom *argv, int n);
 static int OSC_writeStringArg(void *x, OSCbuf *buf, const char *arg);
 static int OSC_writeNullArg(void *x, OSCbuf *buf, char type);
 
@@ -197,6 +206,36 @@ static int OSC_writeNullArg(void *x, OSCbuf *buf, char type);
 static int OSC_effectiveStringLength(const char *string);
 
 static t_class *packOSC_class;
+static t_class *packOSC_shared_class;
+
+/* All packOSC objects in a Pd instance share one atom buffer for the list
+   they output. It is bound to a private symbol so each Pd instance gets its
+   own, grows to the longest packet sent so far, and is freed with the last
+   packOSC. */
+typedef struct _packOSC_shared
+{
+    t_pd        s_pd;
+    t_atom      *s_atoms; /* list output buffer */
+    size_t      s_size; /* number of elements in s_atoms */
+    int         s_refcount; /* number of packOSC objects using this buffer */
+    int         s_busy; /* nonzero while s_atoms is being output */
+} t_packOSC_shared;
+
+/* The address cache holds the padded OSC address (with the prefix applied)
+   for each recently used path symbol, followed by the padded type tag string
+   of the last message sent to that address, so that writing the header of a
+   message is a single memcpy. */
+typedef struct _packOSC_cached
+{
+    t_symbol    *c_path; /* the path symbol this slot is holding, or NULL if empty */
+    char        *c_header; /* padded address followed by padded type tags */
+    size_t      c_size; /* number of bytes allocated for c_header */
+    int         c_addressLength; /* padded length of the address */
+    int         c_headerLength; /* padded length of address and type tags, 0 if no type tags yet */
+    int         c_sent; /* nonzero if c_hash and c_sendTime are for a message sent to c_path */
+    uint64_t    c_hash; /* hash of the last message sent to this address, for dedupe */
+    double      c_sendTime; /* when it was sent */
+} t_packOSC_cached;
 
 typedef struct _packOSC
 {
@@ -204,28 +243,86 @@ typedef struct _packOSC
     int         x_typetags; /* typetag flag */
     int         x_timeTagOffset;
     int         x_bundle; /* bundle open flag */
+    int         x_autobundle; /* autobundle flag */
+    int         x_autoopen; /* nonzero while an automatic bundle is open */
+    size_t      x_autothreshold; /* send the automatic bundle early when it reaches this many bytes, 0 for no limit */
+    t_clock     *x_autoclock; /* sends the automatic bundle at the end of the logical tick */
+    size_t      x_maxpacket; /* largest packet to send, 0 for the buffer size */
+    int         x_splitDepth; /* number of bundles to reopen after sending a split bundle */
+    OSCTimeTag  x_splitTags[MAX_BUNDLE_NESTING]; /* their time tags */
     OSCbuf      x_oscbuf[1]; /* OSCbuffer */
     t_outlet    *x_bdpthout; /* bundle-depth floatoutlet */
     t_outlet    *x_listout; /* OSC packet list ouput */
-    size_t      x_buflength; /* number of elements in x_bufferForOSCbuf and x_bufferForOSClist */
-    char        *x_bufferForOSCbuf; /*[SC_BUFFER_SIZE];*/
-    t_atom      *x_bufferForOSClist; /*[SC_BUFFER_SIZE];*/
+    size_t      x_buflength; /* number of bytes in x_bufferForOSCbuf */
+    char        *x_bufferForOSCbuf; /*[x_buflength];*/
+    t_packOSC_shared *x_shared; /* list output buffer shared by all packOSCs */
     const char  *x_prefix;
+    t_packOSC_cached *x_cache; /* [PACKOSC_CACHE_SIZE] direct-mapped address cache */
+    t_packOSC_cached x_uncached; /* address that can't be cached (not a symbol) */
+    typedArg    *x_args; /* scratch arena for the arguments of the message being sent */
+    size_t      x_argsSize; /* number of elements in x_args */
+    char        *x_typeStr; /* scratch arena for the type tag string */
+    size_t      x_typeStrSize; /* number of bytes in x_typeStr */
+    unsigned long x_cache_hits;
+    unsigned long x_cache_misses;
+    int         x_dedupe; /* dedupe flag */
+    t_float     x_keepalive; /* resend duplicates after this many milliseconds, 0 for never */
+    unsigned long x_suppressed; /* number of duplicates dropped */
     int         x_reentry_count;
     int         x_use_pd_time;
     OSCTimeTag  x_pd_timetag;
     double      x_pd_timeref;
 } t_packOSC;
 
-static void *packOSC_new(void);
+/* [packOSC /address ifs] (or \,ifs) makes a template object instead: the packet is
+   laid out once at creation and each argument lives in a fixed slot, so a
+   new value is written straight into the packet. */
+static t_class *packOSC_template_class;
+static t_class *packOSC_inlet_class;
+
+typedef struct _packOSC_slot
+{
+    char        s_type; /* i, f or s */
+    int         s_offset; /* where the argument starts in x_packet */
+    t_atom      s_value;
+} t_packOSC_slot;
+
+typedef struct _packOSC_inlet
+{
+    t_pd        i_pd;
+    struct _packOSC_template *i_owner;
+    int         i_slot;
+} t_packOSC_inlet;
+
+typedef struct _packOSC_template
+{
+    t_object    x_obj;
+    t_outlet    *x_listout; /* OSC packet list ouput */
+    char        *x_header; /* padded address followed by padded type tags */
+    int         x_addressLength; /* padded length of the address */
+    int         x_headerLength; /* padded length of address and type tags */
+    char        *x_packet; /* the laid out packet */
+    size_t      x_packetSize; /* number of bytes allocated for x_packet */
+    int         x_length; /* number of bytes in the packet */
+    int         x_ntags; /* number of type tags */
+    int         x_nslots; /* number of arguments */
+    t_packOSC_slot *x_slots; /* [x_nslots] */
+    t_packOSC_inlet *x_inlets; /* [x_nslots] proxies, the first one is unused */
+    t_packOSC_shared *x_shared; /* list output buffer shared by all packOSCs */
+} t_packOSC_template;
+
+static void *packOSC_new(t_symbol *s, int argc, t_atom *argv);
 static void packOSC_path(t_packOSC *x, t_symbol*s);
 static void packOSC_openbundle(t_packOSC *x);
 static void packOSC_closebundle(t_packOSC *x);
+static void packOSC_setautobundle(t_packOSC *x, t_floatarg f, t_floatarg threshold);
+static void packOSC_autoflush(t_packOSC *x);
 static void packOSC_settypetags(t_packOSC *x, t_floatarg f);
 static void packOSC_setbufsize(t_packOSC *x, t_floatarg f);
 static void packOSC_usepdtime(t_packOSC *x, t_floatarg f);
 static void packOSC_setTimeTagOffset(t_packOSC *x, t_floatarg f);
-static void packOSC_sendtyped(t_packOSC *x, t_symbol *s, int argc, t_atom *argv);
+static void packOSC_stats(t_packOSC *x);
+static void packOSC_sendtyped(t_packOSC *x, const t_atom *path, int argc, t_atom *argv, int forceTypes);
 static void packOSC_send_type_forced(t_packOSC *x, t_symbol *s, int argc, t_atom *argv);
 static void packOSC_send(t_packOSC *x, t_symbol *s, int argc, t_atom *argv);
 static void packOSC_anything(t_packOSC *x, t_symbol *s, int argc, t_atom *argv);
@@ -234,27 +331,73 @@ void packOSC_setup(void);
 static typedArg packOSC_parseatom(t_atom *a, t_packOSC *x);
 static typedArg packOSC_packMIDI(t_atom *a, t_packOSC *x);
 static typedArg packOSC_forceatom(t_atom *a, char ctype, t_packOSC *x);
-static typedArg packOSC_blob(t_atom *a, t_packOSC *x);
-static int packOSC_writetypedmessage(t_packOSC *x, OSCbuf *buf, char *messageName, int numArgs, typedArg *args, char *typeStr);
-static int packOSC_writemessage(t_packOSC *x, OSCbuf *buf, char *messageName, int numArgs, typedArg *args);
+static typedArg packOSC_force64(t_atom *a, char ctype, t_packOSC *x);
+static int packOSC_blob(const t_atom *a, int n, t_packOSC *x);
+static int packOSC_blobargs(t_packOSC *x, int argc, t_atom *argv, unsigned int *argvIndex, int last, typedArg *arg);
+static int packOSC_writetypedmessage(t_packOSC *x, OSCbuf *buf, t_packOSC_cached *address, int numArgs, typedArg *args, char *typeStr);
+static int packOSC_writemessage(t_packOSC *x, OSCbuf *buf, t_packOSC_cached *address, int numArgs, typedArg *args);
 static void packOSC_sendbuffer(t_packOSC *x);
-
-static void *packOSC_new(void)
+static void packOSC_outputpacket(t_packOSC *x, const unsigned char *buf, int length, int fromOSCbuf);
+static int packOSC_patchmessage(t_packOSC *x, t_packOSC_cached *address, int numArgs, typedArg *args, char *typeStr);
+static t_packOSC_cached *packOSC_getaddress(t_packOSC *x, const t_atom *a);
+static int packOSC_settypes(t_packOSC *x, t_packOSC_cached *c, const char *types);
+static void packOSC_clearcache(t_packOSC *x);
+static OSCTimeTag packOSC_timetag(t_packOSC *x);
+static int packOSC_beginmessage(t_packOSC *x);
+static void packOSC_endmessage(t_packOSC *x);
+static void packOSC_checksize(t_packOSC *x, size_t size);
+static void packOSC_commitmessage(t_packOSC *x, t_packOSC_cached *address, const OSCbuf *saved);
+static void packOSC_sendarray(t_packOSC *x, t_symbol *s, int argc, t_atom *argv);
+static int OSC_writeFloatRun(void *x, OSCbuf *buf, const t_word *vec, int n);
+static int OSC_writeInt64Arg(void *x, OSCbuf *buf, char type, uint64_t arg);
+static int OSC_writeDoubleArg(void *x, OSCbuf *buf, double arg);
+static int OSC_writeBlobRun(void *x, OSCbuf *buf, const t_word *vec, int n);
+static void packOSC_setdedupe(t_packOSC *x, t_floatarg f, t_floatarg keepalive);
+static int packOSC_isduplicate(t_packOSC *x, t_packOSC_cached *address, const char *message, const char *end);
+static void packOSC_setmaxpacket(t_packOSC *x, t_floatarg f);
+static size_t packOSC_packetlimit(t_packOSC *x);
+static int packOSC_makeroom(t_packOSC *x, size_t bytesNeeded);
+static void packOSC_splitbundle(t_packOSC *x);
+static void packOSC_reopenbundles(t_packOSC *x);
+static size_t packOSC_messagesize(t_packOSC *x, t_packOSC_cached *address, int numArgs, typedArg *args, const char *typeStr);
+static t_packOSC_shared *packOSC_shared_get(void);
+static void packOSC_shared_release(t_packOSC_shared *shared);
+static t_atom *packOSC_shared_atoms(void *x, t_packOSC_shared *shared, const unsigned char *buf, int length);
+static void packOSC_shared_output(t_packOSC_shared *shared, t_outlet *out, t_atom *atoms, int length);
+static void *packOSC_template_new(t_symbol *address, int argc, t_atom *argv);
+static void packOSC_template_free(t_packOSC_template *x);
+static int packOSC_template_layout(t_packOSC_template *x);
+static void packOSC_template_set(t_packOSC_template *x, int slot, const t_atom *a);
+static void packOSC_template_bang(t_packOSC_template *x);
+static void packOSC_template_float(t_packOSC_template *x, t_floatarg f);
+static void packOSC_template_symbol(t_packOSC_template *x, t_symbol *s);
+static void packOSC_template_list(t_packOSC_template *x, t_symbol *s, int argc, t_atom *argv);
+static void packOSC_inlet_float(t_packOSC_inlet *x, t_floatarg f);
+static void packOSC_inlet_symbol(t_packOSC_inlet *x, t_symbol *s);
+
+static void *packOSC_new(t_symbol *s, int argc, t_atom *argv)
 {
-    t_packOSC *x = (t_packOSC *)pd_new(packOSC_class);
+    t_packOSC *x;
+    t_float f;
+
+    (void)s;
+    if (argc && argv[0].a_type == A_SYMBOL && argv[0].a_w.w_symbol->s_name[0] == '/')
+        return packOSC_template_new(argv[0].a_w.w_symbol, argc-1, argv+1);
+    f = atom_getfloatarg(0, argc, argv);
+    x = (t_packOSC *)pd_new(packOSC_class);
     x->x_typetags = 1; /* set typetags to 1 by default */
     x->x_bundle = 0; /* bundle is closed */
-    x->x_buflength = SC_BUFFER_SIZE;
+    x->x_buflength = (f >= 1)?(size_t)f:SC_BUFFER_SIZE; /* optional creation argument is the buffer size */
     x->x_bufferForOSCbuf = (char *)getbytes(sizeof(char)*x->x_buflength);
     if(x->x_bufferForOSCbuf == NULL)
     {
         pd_error(x, "packOSC: unable to allocate %lu bytes for x_bufferForOSCbuf", (long)(sizeof(char)*x->x_buflength));
         goto fail;
     }
-    x->x_bufferForOSClist = (t_atom *)getbytes(sizeof(t_atom)*x->x_buflength);
-    if(x->x_bufferForOSClist == NULL)
+    x->x_cache = (t_packOSC_cached *)getzbytes(sizeof(t_packOSC_cached)*PACKOSC_CACHE_SIZE);
+    if(x->x_cache == NULL)
     {
-        pd_error(x, "packOSC: unable to allocate %lu bytes for x_bufferForOSClist", (long)(sizeof(t_atom)*x->x_buflength));
+        pd_error(x, "packOSC: unable to allocate %lu bytes for x_cache", (long)(sizeof(t_packOSC_cached)*PACKOSC_CACHE_SIZE));
         goto fail;
     }
     OSC_initBuffer(x->x_oscbuf, x->x_buflength, x->x_bufferForOSCbuf);
@@ -262,21 +405,95 @@ static void *packOSC_new(void)
     x->x_bdpthout = outlet_new(&x->x_obj, &s_float);
     x->x_timeTagOffset = -1; /* immediately */
     x->x_reentry_count = 0;
+    x->x_autoclock = clock_new(x, (t_method)packOSC_autoflush);
+    x->x_shared = packOSC_shared_get();
 
     packOSC_usepdtime(x, 1.);
     return (x);
 fail:
     if(x->x_bufferForOSCbuf != NULL) freebytes(x->x_bufferForOSCbuf, (long)(sizeof(char)*x->x_buflength));
-    if(x->x_bufferForOSClist != NULL) freebytes(x->x_bufferForOSClist, (long)(sizeof(char)*x->x_buflength));
+    if(x->x_cache != NULL) freebytes(x->x_cache, sizeof(t_packOSC_cached)*PACKOSC_CACHE_SIZE);
     return NULL;
 }
 
+static t_packOSC_shared *packOSC_shared_get(void)
+{
+/* find the output buffer of this Pd instance, or make it if this is the first packOSC */
+    t_symbol            *s = gensym("#packOSC_shared");
+    t_packOSC_shared    *shared = (t_packOSC_shared *)pd_findbyclass(s, packOSC_shared_class);
+
+    if (shared == NULL)
+    {
+        shared = (t_packOSC_shared *)pd_new(packOSC_shared_class);
+        shared->s_atoms = NULL;
+        shared->s_size = 0;
+        shared->s_refcount = 0;
+        shared->s_busy = 0;
+        pd_bind(&shared->s_pd, s);
+    }
+    shared->s_refcount++;
+    return shared;
+}
+
+static void packOSC_shared_release(t_packOSC_shared *shared)
+{
+    if (--shared->s_refcount > 0) return;
+    pd_unbind(&shared->s_pd, gensym("#packOSC_shared"));
+    if (shared->s_atoms != NULL) freebytes(shared->s_atoms, sizeof(t_atom)*shared->s_size);
+    pd_free(&shared->s_pd);
+}
+
+static t_atom *packOSC_shared_atoms(void *x, t_packOSC_shared *shared, const unsigned char *buf, int length)
+{
+/* Return the bytes in buf as a list of floats, in the shared buffer unless that
+   is still being output (we are being called back from downstream), in which
+   case they go into a fresh buffer that packOSC_shared_output frees. */
+    t_atom  *atombuffer;
+    size_t  bufsize = sizeof(t_atom)*length;
+
+    if(shared->s_busy)
+        atombuffer=(t_atom *)getbytes(bufsize);
+    else
+    {
+        if (shared->s_size < (size_t)length)
+        { /* grow the shared buffer to the longest packet seen so far */
+            t_atom *newatoms = (t_atom *)resizebytes(shared->s_atoms,
+                sizeof(t_atom)*shared->s_size, bufsize);
+            if (newatoms != NULL)
+            {
+                shared->s_atoms = newatoms;
+                shared->s_size = length;
+            }
+        }
+        atombuffer = (shared->s_size < (size_t)length)?NULL:shared->s_atoms;
+    }
+    if(!atombuffer) {
+        pd_error(x, "packOSC: unable to allocate %lu bytes for atombuffer", (long)bufsize);
+        return NULL;
+    }
+    /* convert the bytes in the buffer to floats in a list */
+    OSC_bytesToAtoms(atombuffer, buf, length);
+    return atombuffer;
+}
+
+static void packOSC_shared_output(t_packOSC_shared *shared, t_outlet *out, t_atom *atoms, int length)
+{
+/* send the list from packOSC_shared_atoms out the outlet */
+    shared->s_busy++;
+    outlet_list(out, &s_list, length, atoms);
+    shared->s_busy--;
+
+    /* cleanup our 'stack'-allocated atombuffer in the case of reentrancy */
+    if (atoms != shared->s_atoms) freebytes(atoms, sizeof(t_atom)*length);
+}
+
 static void packOSC_path(t_packOSC *x, t_symbol*s)
 {
 /* Set a default prefix to the OSC path */
     if(s == gensym(""))
     {
         x->x_prefix = 0;
+        packOSC_clearcache(x);
         return;
     }
     if ((*s->s_name) != '/')
@@ -285,12 +502,12 @@ static void packOSC_path(t_packOSC *x, t_symbol*s)
         return;
     }
     x->x_prefix = s->s_name;
+    packOSC_clearcache(x); /* the cached addresses all have the old prefix */
 }
 
-static void packOSC_openbundle(t_packOSC *x)
+static OSCTimeTag packOSC_timetag(t_packOSC *x)
 {
-    int result;
-    t_float bundledepth=(t_float)x->x_oscbuf->bundleDepth;
+/* the time tag for a bundle opened now */
     OSCTimeTag tt = OSCTT_Immediately();
 
     if (x->x_timeTagOffset == -1) {
@@ -304,7 +521,20 @@ static void packOSC_openbundle(t_packOSC *x)
           tt = OSCTT_offsetms(OSCTT_Now(), delta);
       }
     }
-    result = OSC_openBundle(x, x->x_oscbuf, tt);
+    return tt;
+}
+
+static void packOSC_openbundle(t_packOSC *x)
+{
+    int result;
+    t_float bundledepth;
+
+    /* messages collected by autobundle go out before the explicit bundle */
+    if (x->x_autoopen) packOSC_autoflush(x);
+    /* a nested bundle needs a size count, "#bundle" and a time tag */
+    if (x->x_oscbuf->bundleDepth > 0) packOSC_makeroom(x, 20);
+    bundledepth=(t_float)x->x_oscbuf->bundleDepth;
+    result = OSC_openBundle(x, x->x_oscbuf, packOSC_timetag(x));
     if (result != 0)
     { /* reset the buffer */
         OSC_initBuffer(x->x_oscbuf, x->x_buflength, x->x_bufferForOSCbuf);
@@ -317,6 +547,11 @@ static void packOSC_openbundle(t_packOSC *x)
 static void packOSC_closebundle(t_packOSC *x)
 {
     t_float bundledepth=(t_float)x->x_oscbuf->bundleDepth;
+    if (x->x_autoopen && bundledepth <= 1)
+    { /* the only open bundle is the automatic one */
+        pd_error(x, "packOSC: Can't close bundle: no bundle is open!");
+        return;
+    }
     if (OSC_closeBundle(x, x->x_oscbuf))
     {
         pd_error(x, "packOSC: Problem closing bundle.");
@@ -332,6 +567,162 @@ static void packOSC_closebundle(t_packOSC *x)
     }
 }
 
+static void packOSC_setautobundle(t_packOSC *x, t_floatarg f, t_floatarg threshold)
+{
+/* With autobundle on, messages sent outside of explicit bundles are
+   collected into one bundle that is sent at the end of the logical tick,
+   or as soon as it is at least threshold bytes long. */
+    x->x_autobundle = (f != 0)?1:0;
+    x->x_autothreshold = (threshold > 0)?(size_t)threshold:0;
+    if (x->x_autothreshold > x->x_buflength) x->x_autothreshold = x->x_buflength;
+    if (!x->x_autobundle && x->x_autoopen) packOSC_autoflush(x);
+    logpost(x, 3, "packOSC: setting autobundle %d threshold %lu", x->x_autobundle, (unsigned long)x->x_autothreshold);
+}
+
+static void packOSC_autoflush(t_packOSC *x)
+{
+/* close the automatic bundle and send it */
+    if (!x->x_autoopen) return;
+    x->x_autoopen = 0;
+    clock_unset(x->x_autoclock);
+    if (OSC_packetSize(x->x_oscbuf) <= 16)
+    { /* nothing but the bundle header: every message failed */
+        OSC_initBuffer(x->x_oscbuf, x->x_buflength, x->x_bufferForOSCbuf);
+        return;
+    }
+    if (OSC_closeBundle(x, x->x_oscbuf))
+    {
+        pd_error(x, "packOSC: Problem closing automatic bundle.");
+        OSC_initBuffer(x->x_oscbuf, x->x_buflength, x->x_bufferForOSCbuf);
+        return;
+    }
+    packOSC_sendbuffer(x);
+}
+
+static int packOSC_beginmessage(t_packOSC *x)
+{
+/* called before a message is written to the buffer */
+    if (x->x_bundle || x->x_autoopen || !x->x_autobundle) return 0;
+    if (OSC_openBundle(x, x->x_oscbuf, packOSC_timetag(x)))
+    {
+        OSC_initBuffer(x->x_oscbuf, x->x_buflength, x->x_bufferForOSCbuf);
+        return 1;
+    }
+    x->x_autoopen = 1;
+    clock_delay(x->x_autoclock, 0);
+    return 0;
+}
+
+static void packOSC_endmessage(t_packOSC *x)
+{
+/* called after a message was written to the buffer */
+    if (x->x_bundle) return; /* in bundle mode we send when bundle is closed */
+    if (!x->x_autoopen) packOSC_sendbuffer(x);
+    else if (x->x_autothreshold && (size_t)OSC_packetSize(x->x_oscbuf) >= x->x_autothreshold)
+        packOSC_autoflush(x);
+}
+
+static void packOSC_setmaxpacket(t_packOSC *x, t_floatarg f)
+{
+/* Bundles that would grow past maxpacket bytes are split into several
+   packets, each a complete bundle with the same time tags. */
+    x->x_maxpacket = (f > 0)?(size_t)f:0;
+    if (x->x_maxpacket > x->x_buflength)
+        logpost(x, 2, "packOSC: maxpacket %lu is larger than the buffer, using %lu",
+            (unsigned long)x->x_maxpacket, (unsigned long)x->x_buflength);
+    logpost(x, 3, "packOSC: setting maxpacket %lu", (unsigned long)x->x_maxpacket);
+}
+
+static size_t packOSC_packetlimit(t_packOSC *x)
+{
+    return (x->x_maxpacket && x->x_maxpacket < x->x_buflength)?x->x_maxpacket:x->x_buflength;
+}
+
+static int packOSC_makeroom(t_packOSC *x, size_t bytesNeeded)
+{
+/* Called before writing bytesNeeded bytes into an open bundle. If they would
+   take the packet past the limit, send what we have so far and continue in
+   a new packet. Returns nonzero if even the new packet is too small. */
+    OSCbuf  *buf = x->x_oscbuf;
+    size_t  limit = packOSC_packetlimit(x);
+    size_t  headers; /* size of the packet with the open bundles and nothing in them */
+
+    if (buf->bundleDepth == 0) return 0;
+    headers = 16 + 20*(buf->bundleDepth-1);
+    if ((size_t)OSC_packetSize(buf) + bytesNeeded <= limit) return 0;
+    if ((size_t)OSC_packetSize(buf) > headers) packOSC_splitbundle(x);
+    return (headers + bytesNeeded > limit);
+}
+
+static void packOSC_splitbundle(t_packOSC *x)
+{
+/* close all the open bundles and send them, packOSC_sendbuffer will open
+   them again before it outputs the packet, in case we get called back */
+    OSCbuf  *buf = x->x_oscbuf;
+    int     depth = buf->bundleDepth;
+
+    debugprint("packOSC_splitbundle: %d bytes at depth %d\n", OSC_packetSize(buf), depth);
+    memcpy(x->x_splitTags, buf->timeTags, sizeof(OSCTimeTag)*(depth+1));
+    while (buf->bundleDepth > 0)
+    {
+        if (OSC_closeBundle(x, buf))
+        {
+            pd_error(x, "packOSC: Problem closing bundle.");
+            OSC_initBuffer(buf, x->x_buflength, x->x_bufferForOSCbuf);
+            x->x_splitDepth = depth;
+            packOSC_reopenbundles(x);
+            return;
+        }
+    }
+    x->x_splitDepth = depth;
+    packOSC_sendbuffer(x);
+}
+
+static void packOSC_reopenbundles(t_packOSC *x)
+{
+    int i, depth = x->x_splitDepth;
+
+    x->x_splitDepth = 0;
+    for (i = 1; i <= depth; ++i)
+    {
+        if (OSC_openBundle(x, x->x_oscbuf, x->x_splitTags[i]))
+        { /* give up on the bundle */
+            OSC_initBuffer(x->x_oscbuf, x->x_buflength, x->x_bufferForOSCbuf);
+            x->x_bundle = 0;
+            x->x_autoopen = 0;
+            clock_unset(x->x_autoclock);
+            outlet_float(x->x_bdpthout, 0);
+            return;
+        }
+    }
+}
+
+static void packOSC_checksize(t_packOSC *x, size_t size)
+{
+/* called before writing a message of size bytes, see that it fits in the packet */
+    if (x->x_oscbuf->bundleDepth > 0)
+    {
+        if (packOSC_makeroom(x, size+4)) /* +4 for the message size count */
+            pd_error(x, "packOSC: %lu byte message doesn't fit in a %lu byte packet",
+                (unsigned long)size, (unsigned long)packOSC_packetlimit(x));
+    }
+    else if (size > packOSC_packetlimit(x))
+        pd_error(x, "packOSC: %lu byte message is larger than maxpacket %lu",
+            (unsigned long)size, (unsigned long)packOSC_packetlimit(x));
+}
+
+static void packOSC_commitmessage(t_packOSC *x, t_packOSC_cached *address, const OSCbuf *saved)
+{
+/* called when a message for address is in the buffer, saved is the buffer from before */
+    if (x->x_dedupe && packOSC_isduplicate(x, address,
+        saved->bufptr+((saved->state == EMPTY)?0:4), x->x_oscbuf->bufptr)) /* skip the size count */
+    { /* take it out again */
+        *x->x_oscbuf = *saved;
+        return;
+    }
+    packOSC_endmessage(x);
+}
+
 static void packOSC_settypetags(t_packOSC *x, t_floatarg f)
 {
     x->x_typetags = (f != 0)?1:0;
@@ -340,16 +731,29 @@ static void packOSC_settypetags(t_packOSC *x, t_floatarg f)
 
 static void packOSC_setbufsize(t_packOSC *x, t_floatarg f)
 {
-    if (x->x_bufferForOSCbuf != NULL) freebytes((void *)x->x_bufferForOSCbuf, sizeof(char)*x->x_buflength);
-    if (x->x_bufferForOSClist != NULL) freebytes((void *)x->x_bufferForOSClist, sizeof(t_atom)*x->x_buflength);
+    char    *newbuf;
+
     logpost(x, 3, "packOSC: bufsize arg is %f (%lu)", f, (long)f);
-    x->x_buflength = (long)f;
-    x->x_bufferForOSCbuf = (char *)getbytes(sizeof(char)*x->x_buflength);
-    if(x->x_bufferForOSCbuf == NULL)
-        pd_error(x, "packOSC unable to allocate %lu bytes for x_bufferForOSCbuf", (long)(sizeof(char)*x->x_buflength));
-    x->x_bufferForOSClist = (t_atom *)getbytes(sizeof(t_atom)*x->x_buflength);
-    if(x->x_bufferForOSClist == NULL)
-        pd_error(x, "packOSC unable to allocate %lu bytes for x_bufferForOSClist", (long)(sizeof(t_atom)*x->x_buflength));
+    if (f < 1)
+    {
+        pd_error(x, "packOSC: bufsize must be at least 1 byte");
+        return;
+    }
+    newbuf = (char *)getbytes(sizeof(char)*(size_t)f);
+    if(newbuf == NULL)
+    {
+        pd_error(x, "packOSC unable to allocate %lu bytes for x_bufferForOSCbuf", (long)(sizeof(char)*(size_t)f));
+        return;
+    }
+    if (x->x_bufferForOSCbuf != NULL) freebytes((void *)x->x_bufferForOSCbuf, sizeof(char)*x->x_buflength);
+    x->x_buflength = (size_t)f;
+    x->x_bufferForOSCbuf = newbuf;
+    x->x_bundle = 0; /* any open bundle is discarded along with the old buffer */
+    x->x_splitDepth = 0;
+    x->x_autoopen = 0;
+    clock_unset(x->x_autoclock);
+    if (x->x_autothreshold > x->x_buflength) x->x_autothreshold = x->x_buflength;
+    outlet_float(x->x_bdpthout, 0);
     OSC_initBuffer(x->x_oscbuf, x->x_buflength, x->x_bufferForOSCbuf);
     logpost(x, 3, "packOSC: bufsize is now %ld", (long unsigned int)x->x_buflength);
 }
@@ -371,28 +775,88 @@ static void packOSC_setTimeTagOffset(t_packOSC *x, t_floatarg f)
 {
     x->x_timeTagOffset = (int)f;
 }
-/* this is the real and only sending routine now, for both typed and */
-/* undtyped mode. */
 
-static void packOSC_sendtyped(t_packOSC *x, t_symbol *s, int argc, t_atom *argv)
+static void packOSC_stats(t_packOSC *x)
 {
-    char            messageName[MAXPDSTRING];
-    unsigned int    nTypeTags = 0, typeStrTotalSize = 0;
-    unsigned int    argsSize = sizeof(typedArg)*argc;
-    char*           typeStr = NULL; /* might not be used */
-    typedArg*       args = (typedArg*)getbytes(argsSize);
-    unsigned int    i, nTagsWithData, nArgs, blobCount;
-    unsigned int    m, tagIndex, typedArgIndex, argvIndex;
-    char            c;
-    (void)s;
+    post("packOSC: address cache: %lu hits, %lu misses", x->x_cache_hits, x->x_cache_misses);
+    post("packOSC: dedupe: %lu messages suppressed", x->x_suppressed);
+}
 
-    debugprint("*** packOSC_sendtyped bundle %d reentry %d\n", x->x_bundle, x->x_reentry_count);
-    x->x_reentry_count++;
-    if (args == NULL)
+static void packOSC_setdedupe(t_packOSC *x, t_floatarg f, t_floatarg keepalive)
+{
+/* With dedupe on, a message that is the same as the last one sent to its
+   address is dropped, unless that was at least keepalive milliseconds ago. */
+    int i;
+
+    x->x_dedupe = (f != 0)?1:0;
+    x->x_keepalive = (keepalive > 0)?keepalive:0;
+    for (i = 0; i < PACKOSC_CACHE_SIZE; ++i) x->x_cache[i].c_sent = 0;
+    logpost(x, 3, "packOSC: setting dedupe %d keepalive %g", x->x_dedupe, x->x_keepalive);
+}
+
+static int packOSC_isduplicate(t_packOSC *x, t_packOSC_cached *address, const char *message, const char *end)
+{
+/* message to end is a message for address, including the address and type
+   tags. Returns nonzero if it should be dropped, otherwise remembers it. */
+    const uint32_t  *word;
+    uint64_t        hash = 14695981039346656037ULL; /* FNV-1a, a word at a time */
+
+    for (word = (const uint32_t *)message; word < (const uint32_t *)end; ++word)
     {
-        pd_error(x, "packOSC: unable to allocate %lu bytes for args", (long)argsSize);
-        return;
+        hash ^= *word;
+        hash *= 1099511628211ULL;
+    }
+    if (address->c_sent && address->c_hash == hash
+        && (x->x_keepalive <= 0 || clock_gettimesince(address->c_sendTime) < x->x_keepalive))
+    {
+        x->x_suppressed++;
+        return 1;
     }
+    address->c_sent = 1;
+    address->c_hash = hash;
+    address->c_sendTime = clock_getlogicaltime();
+    return 0;
+}
+
+static size_t packOSC_cachehash(const t_symbol *s)
+{ /* symbols are allocated on at least 8-byte boundaries */
+    return ((size_t)s >> 3) & (PACKOSC_CACHE_SIZE-1);
+}
+
+static int packOSC_reserveheader(t_packOSC *x, t_packOSC_cached *c, size_t size)
+{ /* make sure c->c_header can hold size bytes */
+    char *header;
+
+    if (size <= c->c_size) return 0;
+    header = (char *)resizebytes(c->c_header, c->c_size, size);
+    if (header == NULL)
+    {
+        pd_error(x, "packOSC: unable to allocate %lu bytes for address", (long)size);
+        return 1;
+    }
+    c->c_header = header;
+    c->c_size = size;
+    return 0;
+}
+
+static t_packOSC_cached *packOSC_getaddress(t_packOSC *x, const t_atom *a)
+{ /* return the cache slot holding the padded address for a, filling it on a miss */
+    t_packOSC_cached    *c;
+    char                messageName[MAXPDSTRING];
+    int                 paddedLength;
+
+    if (a->a_type == A_SYMBOL)
+    {
+        c = &x->x_cache[packOSC_cachehash(a->a_w.w_symbol)];
+        if (c->c_path == a->a_w.w_symbol)
+        {
+            x->x_cache_hits++;
+            return c;
+        }
+        x->x_cache_misses++;
+    }
+    else c = &x->x_uncached;
+
     messageName[0] = '\0'; /* empty */
     if(x->x_prefix) /* if there is a prefix, prefix it to the path */
     {
@@ -401,93 +865,153 @@ static void packOSC_sendtyped(t_packOSC *x, t_symbol *s, int argc, t_atom *argv)
         len = MAXPDSTRING-1;
 
         strncpy(messageName, x->x_prefix, MAXPDSTRING);
-        atom_string(&argv[0], messageName+len, (unsigned)(MAXPDSTRING-len));
+        atom_string(a, messageName+len, (unsigned)(MAXPDSTRING-len));
     }
     else
-        atom_string(&argv[0], messageName, MAXPDSTRING); /* the OSC address string */
-
-    if (x->x_typetags & 2)
-    { /* second arg is typestring */
-        /* we need to find out how long the type string is before we copy it*/
-        nTypeTags = (unsigned int)strlen(atom_getsymbol(&argv[1])->s_name);
-        typeStrTotalSize = nTypeTags + 2;
-        typeStr = (char*)getzbytes(typeStrTotalSize);
+        atom_string(a, messageName, MAXPDSTRING); /* the OSC address string */
+
+    c->c_path = NULL; /* in case we fail */
+    c->c_sent = 0;
+    paddedLength = OSC_effectiveStringLength(messageName);
+    if (packOSC_reserveheader(x, c, paddedLength)) return NULL;
+    OSC_padString(c->c_header, messageName);
+    c->c_addressLength = paddedLength;
+    c->c_headerLength = 0;
+    if (a->a_type == A_SYMBOL) c->c_path = a->a_w.w_symbol;
+    return c;
+}
+
+static int packOSC_settypes(t_packOSC *x, t_packOSC_cached *c, const char *types)
+{ /* append the padded type tag string to the cached address unless it's already there */
+    int paddedLength;
+
+    if (c->c_headerLength && !strcmp(c->c_header+c->c_addressLength, types)) return 0;
+    paddedLength = OSC_effectiveStringLength(types);
+    if (packOSC_reserveheader(x, c, c->c_addressLength+paddedLength)) return 1;
+    OSC_padString(c->c_header+c->c_addressLength, types);
+    c->c_headerLength = c->c_addressLength+paddedLength;
+    return 0;
+}
+
+static void packOSC_clearcache(t_packOSC *x)
+{
+    int i;
+
+    for (i = 0; i < PACKOSC_CACHE_SIZE; ++i) x->x_cache[i].c_path = NULL;
+}
+static int packOSC_reservescratch(t_packOSC *x, size_t nArgs, size_t nTypeChars)
+{ /* grow the scratch arenas so the send path doesn't need to allocate */
+    if (nArgs > x->x_argsSize)
+    {
+        typedArg *args = (typedArg *)resizebytes(x->x_args, sizeof(typedArg)*x->x_argsSize, sizeof(typedArg)*nArgs);
+        if (args == NULL)
+        {
+            pd_error(x, "packOSC: unable to allocate %lu bytes for args", (long)(sizeof(typedArg)*nArgs));
+            return 1;
+        }
+        x->x_args = args;
+        x->x_argsSize = nArgs;
+    }
+    if (nTypeChars > x->x_typeStrSize)
+    {
+        char *typeStr = (char *)resizebytes(x->x_typeStr, x->x_typeStrSize, nTypeChars);
         if (typeStr == NULL)
         {
-            pd_error(x, "packOSC: unable to allocate %u bytes for typeStr", nTypeTags);
-            return;
+            pd_error(x, "packOSC: unable to allocate %lu bytes for typeStr", (long)nTypeChars);
+            return 1;
         }
+        x->x_typeStr = typeStr;
+        x->x_typeStrSize = nTypeChars;
+    }
+    return 0;
+}
+
+/* this is the real and only sending routine now, for both typed and */
+/* undtyped mode. */
+/* path is the OSC address and argv holds the arguments, preceded by the */
+/* type string if forceTypes is nonzero. */
+/* The x_args and x_typeStr scratch arenas are only used until the message */
+/* is in the OSCbuf, so it doesn't matter if we get called again while sending it. */
+
+static void packOSC_sendtyped(t_packOSC *x, const t_atom *path, int argc, t_atom *argv, int forceTypes)
+{
+    t_packOSC_cached *address;
+    unsigned int    nTypeTags = 0;
+    char*           typeStr; /* might not be used */
+    typedArg*       args;
+    unsigned int    i, nArgs, lastData;
+    unsigned int    m, tagIndex, typedArgIndex, argvIndex;
+    char            c;
+    OSCbuf          saved[1]; /* the buffer before this message */
+
+    debugprint("*** packOSC_sendtyped bundle %d reentry %d\n", x->x_bundle, x->x_reentry_count);
+    x->x_reentry_count++;
+    address = packOSC_getaddress(x, path); /* the OSC address string */
+    if (address == NULL) goto cleanup;
+
+    if (forceTypes)
+    { /* first arg is typestring */
+        const char *tags = atom_getsymbol(&argv[0])->s_name;
+        nTypeTags = (unsigned int)strlen(tags);
+        if (packOSC_reservescratch(x, argc, nTypeTags+2)) goto cleanup;
+        args = x->x_args;
+        typeStr = x->x_typeStr;
         typeStr[0] = ',';
-        atom_string(&argv[1], &typeStr[1], typeStrTotalSize);
+        memcpy(&typeStr[1], tags, nTypeTags+1);
         debugprint("packOSC_sendtyped typeStr: %s, nTypeTags %u\n", typeStr, nTypeTags);
-        nArgs = argc-2;
-        for (m = nTagsWithData = blobCount = 0; m < nTypeTags; ++m)
+        nArgs = argc-1;
+        m = nTypeTags; /* the number of tags */
+        /* a blob without a length is allowed as the last argument, it takes the rest of the atoms */
+        for (lastData = m; lastData > 0; --lastData)
         {
-            debugprint("packOSC_sendtyped typeStr[%d] %c\n", m+1, typeStr[m+1]);
-            if ((c = typeStr[m+1]) == 0) break;
-            if (!(c == 'T' || c == 'F' || c == 'N' || c == 'I'))
+            c = typeStr[lastData];
+            if (!(c == 'T' || c == 'F' || c == 'N' || c == 'I')) break;
+        }
+        for (tagIndex = typedArgIndex = 0, argvIndex = 1; tagIndex < m; ++tagIndex)
+        {
+            c = typeStr[tagIndex+1];
+            if (c == 'T' || c == 'F' || c == 'N' || c == 'I') continue; /* no data */
+            if (argvIndex + ((c == 'm')?4:(c == 'h' || c == 't')?OSC_INT64_ATOMS:1) > (unsigned)argc)
+            {
+                pd_error(x, "packOSC: Not enough arguments (%d) for type tags %s", nArgs, tags);
+                goto cleanup;
+            }
+            if (c == 'b')
             {
-                ++nTagsWithData; /* anything other than these tags have at least one data byte */
-                if (c == 'm') nTagsWithData += 3; // MIDI tag should have four data bytes
 /*
     OSC-blob
     An int32 size count, followed by that many 8-bit bytes of arbitrary binary data,
     followed by 0-3 additional zero bytes to make the total number of bits a multiple of 32.
 */
-                if (c == 'b') blobCount++; /* b probably has more than one byte, so set a flag */
-            }
-        }
-        if (((blobCount == 0)&&(nTagsWithData != nArgs)) || ((blobCount != 0)&&(nTagsWithData > nArgs)))
-        {
-            pd_error(x, "packOSC: Tags count %d doesn't match argument count %d", nTagsWithData, nArgs);
-            goto cleanup;
-        }
-        if (blobCount > 1)
-        {
-            pd_error(x, "packOSC: Only one blob per packet at the moment...");
-            goto cleanup;
-        }
-        for (tagIndex = typedArgIndex = 0, argvIndex = 2; tagIndex < m; ++tagIndex) /* m is the number of tags */
-        {
-            c = typeStr[tagIndex+1];
-            if (c == 'b')
-            { /* A blob has to be the last item, until we get more elaborate. */
-                if (tagIndex != m-1)
-                {
-                    pd_error(x, "packOSC: Since I don't know how big the blob is, Blob must be the last item in the list");
+                if (packOSC_blobargs(x, argc, argv, &argvIndex, (tagIndex+1 == lastData), &args[typedArgIndex++]))
                     goto cleanup;
-                }
-                /* Pack all the remaining arguments as a blob */
-                for (; typedArgIndex < nArgs; ++typedArgIndex, ++argvIndex)
-                {
-                    debugprint("packOSC_blob %d:\n", nArgs);
-                    args[typedArgIndex] = packOSC_blob(&argv[argvIndex], x);
-                    /* Make sure it was blobbable */
-                    if (args[typedArgIndex].type != BLOB_osc) goto cleanup;
-                }
             }
-            else if (!(c == 'T' || c == 'F' || c == 'N' || c == 'I')) /* not no data */
+            else if (c == 'm')
+            { // pack the next four arguments into one int
+              args[typedArgIndex++] = packOSC_packMIDI(&argv[argvIndex], x);
+              argvIndex += 4;
+            }
+            else if (c == 'h' || c == 't')
             {
-                if (c == 'm')
-                { // pack the next four arguments into one int
-                  args[typedArgIndex++] = packOSC_packMIDI(&argv[argvIndex], x);
-                  argvIndex += 4;
-                }
-                else args[typedArgIndex++] = packOSC_forceatom(&argv[argvIndex++], c, x);
+                args[typedArgIndex++] = packOSC_force64(&argv[argvIndex], c, x);
+                argvIndex += OSC_INT64_ATOMS;
             }
+            else args[typedArgIndex++] = packOSC_forceatom(&argv[argvIndex++], c, x);
         }
-        //if(packOSC_writetypedmessage(x, x->x_oscbuf, messageName, nArgs, args, typeStr))
-        if(packOSC_writetypedmessage(x, x->x_oscbuf, messageName, typedArgIndex, args, typeStr))
+        if (argvIndex != (unsigned)argc)
         {
-            pd_error(x, "packOSC: usage error, packOSC_writetypedmessage failed.");
+            pd_error(x, "packOSC: Type tags %s don't use all %d arguments", tags, nArgs);
             goto cleanup;
         }
+        nArgs = typedArgIndex;
     }
     else
     {
-        for (i = 0; i < (unsigned)(argc-1); i++)
+        if (packOSC_reservescratch(x, argc, argc+2)) goto cleanup;
+        args = x->x_args;
+        for (i = 0; i < (unsigned)argc; i++)
         {
-            args[i] = packOSC_parseatom(&argv[i+1], x);
+            args[i] = packOSC_parseatom(&argv[i], x);
 #if DEBUG
             switch (args[i].type)
             {
@@ -511,45 +1035,53 @@ static void packOSC_sendtyped(t_packOSC *x, t_symbol *s, int argc, t_atom *argv)
             debugprint("packOSC:   type-id: %d\n", args[i].type);
 #endif
         }
-        if(packOSC_writemessage(x, x->x_oscbuf, messageName, i, args))
-        {
-            pd_error(x, "packOSC: usage error, packOSC_writemessage failed.");
-            goto cleanup;
-        }
+        nArgs = i;
+        typeStr = NULL;
     }
 
-    if(!x->x_bundle)
+    if (packOSC_patchmessage(x, address, nArgs, args, typeStr)) goto cleanup;
+    if (packOSC_beginmessage(x)) goto cleanup;
+    packOSC_checksize(x, packOSC_messagesize(x, address, nArgs, args, typeStr));
+    *saved = *x->x_oscbuf;
+    if (forceTypes?packOSC_writetypedmessage(x, x->x_oscbuf, address, nArgs, args, typeStr)
+        :packOSC_writemessage(x, x->x_oscbuf, address, nArgs, args))
     {
-        packOSC_sendbuffer(x);
+        pd_error(x, "packOSC: usage error, %s failed.", forceTypes?"packOSC_writetypedmessage":"packOSC_writemessage");
+        *x->x_oscbuf = *saved; /* take the failed message out of the buffer */
+        goto cleanup;
     }
+    packOSC_commitmessage(x, address, saved);
 
 cleanup:
-    if (typeStr != NULL) freebytes(typeStr, typeStrTotalSize);
-    if (args != NULL) freebytes(args, argsSize);
     x->x_reentry_count--;
 }
 
 static void packOSC_send_type_forced(t_packOSC *x, t_symbol *s, int argc, t_atom *argv)
 { /* typetags are the argument following the OSC path */
-    x->x_typetags |= 2;/* tell packOSC_sendtyped to use the specified typetags... */
-    packOSC_sendtyped(x, s, argc, argv);
-    x->x_typetags &= ~2;/* ...this time only */
+    (void)s;
+    if(argc < 2)
+    {
+        pd_error(x, "packOSC: sendtyped needs a path and a type string.");
+        return;
+    }
+    packOSC_sendtyped(x, &argv[0], argc-1, argv+1, 1);
 }
 
 static void packOSC_send(t_packOSC *x, t_symbol *s, int argc, t_atom *argv)
 {
+    (void)s;
     if(!argc)
     {
         pd_error(x, "packOSC: not sending empty message.");
         return;
     }
-    packOSC_sendtyped(x, s, argc, argv);
+    packOSC_sendtyped(x, &argv[0], argc-1, argv+1, 0);
 }
 
 static void packOSC_anything(t_packOSC *x, t_symbol *s, int argc, t_atom *argv)
 {
 /* If the message starts with '/', assume it's an OSC path and send it */
-    t_atom*ap = 0;
+    t_atom path;
 
     if ((*s->s_name)!='/')
     {
@@ -557,29 +1089,351 @@ static void packOSC_anything(t_packOSC *x, t_symbol *s, int argc, t_atom *argv)
         return;
     }
 
-    ap = (t_atom*)getbytes((argc+1)*sizeof(t_atom));
-    SETSYMBOL(ap, s);
-    memcpy(ap+1, argv, argc * sizeof(t_atom));
+    SETSYMBOL(&path, s);
+    packOSC_sendtyped(x, &path, argc, argv, 0);
+}
 
-    packOSC_send(x, gensym("send"), argc+1, ap);
+static void packOSC_sendarray(t_packOSC *x, t_symbol *s, int argc, t_atom *argv)
+{
+/* sendarray <address> <arrayname> [onset] [n] [f|b]
+   sends the array as a run of floats, or as a blob if the values are bytes */
+    t_garray            *a;
+    t_word              *vec;
+    t_symbol            *arrayname;
+    t_packOSC_cached    *address;
+    OSCbuf              saved[1]; /* the buffer before this message */
+    int                 i, size, onset = 0, n = -1, nfloats = 0, blob = 0, result;
 
-    freebytes(ap, (argc+1)*sizeof(t_atom));
+    (void)s;
+    if (argc < 2 || argv[0].a_type != A_SYMBOL || argv[1].a_type != A_SYMBOL)
+    {
+        pd_error(x, "packOSC: usage: sendarray <address> <arrayname> [onset] [n] [f|b]");
+        return;
+    }
+    arrayname = argv[1].a_w.w_symbol;
+    for (i = 2; i < argc; ++i)
+    {
+        if (argv[i].a_type == A_FLOAT && nfloats < 2)
+        {
+            if (nfloats++ == 0) onset = (int)argv[i].a_w.w_float;
+            else n = (int)argv[i].a_w.w_float;
+        }
+        else if (argv[i].a_type == A_SYMBOL && (argv[i].a_w.w_symbol == gensym("f") || argv[i].a_w.w_symbol == gensym("b")))
+            blob = (argv[i].a_w.w_symbol == gensym("b"));
+        else
+        {
+            pd_error(x, "packOSC: usage: sendarray <address> <arrayname> [onset] [n] [f|b]");
+            return;
+        }
+    }
+    if (!(a = (t_garray *)pd_findbyclass(arrayname, garray_class)))
+    {
+        pd_error(x, "packOSC: %s: no such array", arrayname->s_name);
+        return;
+    }
+    if (!garray_getfloatwords(a, &size, &vec))
+    {
+        pd_error(x, "packOSC: %s: bad template for sendarray", arrayname->s_name);
+        return;
+    }
+    if (onset < 0) onset = 0;
+    if (onset > size) onset = size;
+    if (n < 0 || n > size-onset) n = size-onset;
+
+    address = packOSC_getaddress(x, &argv[0]);
+    if (address == NULL) return;
+    if (x->x_typetags)
+    { /* the type tags are a run of f, or a single b */
+        if (packOSC_reservescratch(x, 0, (blob?1:n)+2)) return;
+        x->x_typeStr[0] = ',';
+        if (blob) x->x_typeStr[1] = 'b';
+        else memset(x->x_typeStr+1, 'f', n);
+        x->x_typeStr[(blob?1:n)+1] = '\0';
+        if (packOSC_settypes(x, address, x->x_typeStr)) return;
+    }
 
+    if (packOSC_beginmessage(x)) return;
+    packOSC_checksize(x, ((x->x_typetags)?address->c_headerLength:address->c_addressLength)+(blob?(4+((n+3)&~3)):4*n));
+    *saved = *x->x_oscbuf;
+    if (x->x_typetags)
+        result = OSC_writeAddressAndTypes(x, x->x_oscbuf, address->c_header, address->c_addressLength, address->c_headerLength);
+    else
+        result = OSC_writeAddress(x, x->x_oscbuf, address->c_header, address->c_addressLength);
+    if (!result)
+        result = blob?OSC_writeBlobRun(x, x->x_oscbuf, vec+onset, n):OSC_writeFloatRun(x, x->x_oscbuf, vec+onset, n);
+    if (result)
+    {
+        pd_error(x, "packOSC: problem writing %s to %s.", arrayname->s_name, address->c_header);
+        *x->x_oscbuf = *saved; /* take the failed message out of the buffer */
+        return;
+    }
+    packOSC_commitmessage(x, address, saved);
 }
 
 static void packOSC_free(t_packOSC *x)
 {
+    int i;
+
     if (x->x_bufferForOSCbuf != NULL) freebytes((void *)x->x_bufferForOSCbuf, sizeof(char)*x->x_buflength);
-    if (x->x_bufferForOSClist != NULL) freebytes((void *)x->x_bufferForOSClist, sizeof(t_atom)*x->x_buflength);
+    if (x->x_shared != NULL) packOSC_shared_release(x->x_shared);
+    if (x->x_autoclock != NULL) clock_free(x->x_autoclock);
+    if (x->x_cache != NULL)
+    {
+        for (i = 0; i < PACKOSC_CACHE_SIZE; ++i)
+            if (x->x_cache[i].c_header != NULL) freebytes(x->x_cache[i].c_header, x->x_cache[i].c_size);
+        freebytes(x->x_cache, sizeof(t_packOSC_cached)*PACKOSC_CACHE_SIZE);
+    }
+    if (x->x_uncached.c_header != NULL) freebytes(x->x_uncached.c_header, x->x_uncached.c_size);
+    if (x->x_args != NULL) freebytes(x->x_args, sizeof(typedArg)*x->x_argsSize);
+    if (x->x_typeStr != NULL) freebytes(x->x_typeStr, x->x_typeStrSize);
+}
+
+static void *packOSC_template_new(t_symbol *address, int argc, t_atom *argv)
+{
+    t_packOSC_template  *x;
+    const char          *types = "";
+    char                c;
+    int                 i, nTags, paddedLength;
+
+    /* typed into a box an unescaped comma arrives as its own atom, before the types */
+    if (argc > 0 && argv[0].a_type == A_COMMA)
+    {
+        argc--;
+        argv++;
+    }
+    if (argc > 0)
+    {
+        if (argv[0].a_type != A_SYMBOL || argc > 1)
+        {
+            pd_error(0, "packOSC %s: expected a type string like ifs or \\,ifs after the address", address->s_name);
+            return NULL;
+        }
+        types = argv[0].a_w.w_symbol->s_name;
+        if (types[0] == ',') types++;
+    }
+    nTags = (int)strlen(types);
+    for (i = 0; i < nTags; ++i)
+    {
+        c = types[i];
+        if (!(c == 'i' || c == 'f' || c == 's' || c == 'T' || c == 'F' || c == 'N' || c == 'I'))
+        {
+            pd_error(0, "packOSC %s: type %c can't be used in a template", address->s_name, c);
+            return NULL;
+        }
+    }
+    x = (t_packOSC_template *)pd_new(packOSC_template_class);
+    x->x_addressLength = OSC_effectiveStringLength(address->s_name);
+    paddedLength = OSC_effectiveStringLength(types)+((nTags%4 == 3)?4:0); /* room for the comma */
+    x->x_header = (char *)getbytes(x->x_addressLength+paddedLength);
+    x->x_slots = (t_packOSC_slot *)getbytes(sizeof(t_packOSC_slot)*(nTags+1));
+    x->x_inlets = (t_packOSC_inlet *)getbytes(sizeof(t_packOSC_inlet)*(nTags+1));
+    x->x_packet = NULL;
+    x->x_packetSize = 0;
+    x->x_ntags = nTags;
+    OSC_padString(x->x_header, address->s_name);
+    x->x_headerLength = x->x_addressLength+OSC_padStringWithAnExtraStupidComma(x->x_header+x->x_addressLength, types);
+    for (i = x->x_nslots = 0; i < nTags; ++i)
+    {
+        c = types[i];
+        if (c == 'T' || c == 'F' || c == 'N' || c == 'I') continue; /* no data, no slot */
+        x->x_slots[x->x_nslots].s_type = c;
+        if (c == 's') SETSYMBOL(&x->x_slots[x->x_nslots].s_value, &s_);
+        else SETFLOAT(&x->x_slots[x->x_nslots].s_value, 0);
+        if (x->x_nslots > 0)
+        { /* the left inlet is the object's own, the others are proxies */
+            x->x_inlets[x->x_nslots].i_pd = packOSC_inlet_class;
+            x->x_inlets[x->x_nslots].i_owner = x;
+            x->x_inlets[x->x_nslots].i_slot = x->x_nslots;
+            inlet_new(&x->x_obj, &x->x_inlets[x->x_nslots].i_pd, 0, 0);
+        }
+        x->x_nslots++;
+    }
+    x->x_listout = outlet_new(&x->x_obj, &s_list);
+    x->x_shared = packOSC_shared_get();
+    if (packOSC_template_layout(x))
+    {
+        pd_free((t_pd *)x);
+        return NULL;
+    }
+    return (x);
+}
+
+static void packOSC_template_free(t_packOSC_template *x)
+{
+    if (x->x_shared != NULL) packOSC_shared_release(x->x_shared);
+    if (x->x_packet != NULL) freebytes(x->x_packet, x->x_packetSize);
+    if (x->x_header != NULL) freebytes(x->x_header, x->x_headerLength);
+    if (x->x_slots != NULL) freebytes(x->x_slots, sizeof(t_packOSC_slot)*(x->x_ntags+1));
+    if (x->x_inlets != NULL) freebytes(x->x_inlets, sizeof(t_packOSC_inlet)*(x->x_ntags+1));
+}
+
+static int packOSC_template_layout(t_packOSC_template *x)
+{
+/* write the whole packet from the slot values, noting where each argument goes */
+    OSCbuf  buf[1];
+    size_t  size = x->x_headerLength;
+    int     i, result = 0;
+
+    for (i = 0; i < x->x_nslots; ++i)
+    {
+        if (x->x_slots[i].s_type == 's')
+            size += OSC_effectiveStringLength(x->x_slots[i].s_value.a_w.w_symbol->s_name);
+        else size += 4;
+    }
+    if (size > x->x_packetSize)
+    {
+        char *packet = (char *)resizebytes(x->x_packet, x->x_packetSize, size);
+        if (packet == NULL)
+        {
+            pd_error(x, "packOSC: unable to allocate %lu bytes for packet", (long)size);
+            return 1;
+        }
+        x->x_packet = packet;
+        x->x_packetSize = size;
+    }
+    OSC_initBuffer(buf, x->x_packetSize, x->x_packet);
+    result = OSC_writeAddressAndTypes(x, buf, x->x_header, x->x_addressLength, x->x_headerLength);
+    for (i = 0; i < x->x_nslots && !result; ++i)
+    {
+        t_packOSC_slot *slot = &x->x_slots[i];
+
+        slot->s_offset = OSC_packetSize(buf);
+        switch (slot->s_type)
+        {
+            case 'i':
+                result = OSC_writeIntArg(x, buf, (int)slot->s_value.a_w.w_float);
+                break;
+            case 'f':
+                result = OSC_writeFloatArg(x, buf, slot->s_value.a_w.w_float);
+                break;
+            case 's':
+                result = OSC_writeStringArg(x, buf, slot->s_value.a_w.w_symbol->s_name);
+                break;
+        }
+    }
+    x->x_length = OSC_packetSize(buf);
+    return result;
+}
+
+static void packOSC_template_set(t_packOSC_template *x, int slot, const t_atom *a)
+{
+/* store a new value for an argument and patch it into the packet */
+    t_packOSC_slot  *p = &x->x_slots[slot];
+    intfloat32      if32;
+
+    if ((p->s_type == 's') != (a->a_type == A_SYMBOL))
+    {
+        pd_error(x, "packOSC: argument %d is type %c, can't set it to a %s", slot+1, p->s_type,
+            (a->a_type == A_SYMBOL)?"symbol":"float");
+        return;
+    }
+    switch (p->s_type)
+    {
+        case 'i':
+            p->s_value.a_w.w_float = a->a_w.w_float;
+            *((uint32_t *)(x->x_packet+p->s_offset)) = htonl((int)a->a_w.w_float);
+            break;
+        case 'f':
+            p->s_value.a_w.w_float = a->a_w.w_float;
+            if32.f = a->a_w.w_float;
+            *((uint32_t *)(x->x_packet+p->s_offset)) = htonl(if32.i);
+            break;
+        case 's':
+            if (OSC_effectiveStringLength(a->a_w.w_symbol->s_name)
+                == OSC_effectiveStringLength(p->s_value.a_w.w_symbol->s_name))
+            { /* same padded length, the rest of the packet stays where it is */
+                p->s_value.a_w.w_symbol = a->a_w.w_symbol;
+                OSC_padString(x->x_packet+p->s_offset, a->a_w.w_symbol->s_name);
+            }
+            else
+            {
+                p->s_value.a_w.w_symbol = a->a_w.w_symbol;
+                packOSC_template_layout(x);
+            }
+            break;
+    }
+}
+
+static void packOSC_template_bang(t_packOSC_template *x)
+{
+    t_atom *atombuffer = packOSC_shared_atoms(x, x->x_shared, (unsigned char *)x->x_packet, x->x_length);
+    if (atombuffer != NULL) packOSC_shared_output(x->x_shared, x->x_listout, atombuffer, x->x_length);
+}
+
+static void packOSC_template_float(t_packOSC_template *x, t_floatarg f)
+{
+    t_atom a;
+
+    SETFLOAT(&a, f);
+    if (x->x_nslots) packOSC_template_set(x, 0, &a);
+    packOSC_template_bang(x);
+}
+
+static void packOSC_template_symbol(t_packOSC_template *x, t_symbol *s)
+{
+    t_atom a;
+
+    SETSYMBOL(&a, s);
+    if (x->x_nslots) packOSC_template_set(x, 0, &a);
+    packOSC_template_bang(x);
+}
+
+static void packOSC_template_list(t_packOSC_template *x, t_symbol *s, int argc, t_atom *argv)
+{ /* a list sets the arguments from left to right */
+    int i;
+
+    (void)s;
+    if (argc > x->x_nslots)
+        pd_error(x, "packOSC: %d values for %d arguments, ignoring the extra ones", argc, x->x_nslots);
+    for (i = 0; i < argc && i < x->x_nslots; ++i) packOSC_template_set(x, i, &argv[i]);
+    packOSC_template_bang(x);
+}
+
+static void packOSC_inlet_float(t_packOSC_inlet *x, t_floatarg f)
+{
+    t_atom a;
+
+    SETFLOAT(&a, f);
+    packOSC_template_set(x->i_owner, x->i_slot, &a);
+}
+
+static void packOSC_inlet_symbol(t_packOSC_inlet *x, t_symbol *s)
+{
+    t_atom a;
+
+    SETSYMBOL(&a, s);
+    packOSC_template_set(x->i_owner, x->i_slot, &a);
 }
 
 void packOSC_setup(void)
 {
     packOSC_class = class_new(gensym("packOSC"), (t_newmethod)packOSC_new,
         (t_method)packOSC_free,
-        sizeof(t_packOSC), 0, A_DEFFLOAT, 0);
+        sizeof(t_packOSC), 0, A_GIMME, 0);
+    packOSC_shared_class = class_new(gensym("packOSC shared buffer"), 0, 0,
+        sizeof(t_packOSC_shared), CLASS_PD, 0);
+    packOSC_template_class = class_new(gensym("packOSC template"), 0,
+        (t_method)packOSC_template_free,
+        sizeof(t_packOSC_template), 0, 0);
+    class_addbang(packOSC_template_class, packOSC_template_bang);
+    class_addfloat(packOSC_template_class, packOSC_template_float);
+    class_addsymbol(packOSC_template_class, packOSC_template_symbol);
+    class_addlist(packOSC_template_class, packOSC_template_list);
+    class_sethelpsymbol(packOSC_template_class, gensym("packOSC"));
+    packOSC_inlet_class = class_new(gensym("packOSC inlet"), 0, 0,
+        sizeof(t_packOSC_inlet), CLASS_PD, 0);
+    class_addfloat(packOSC_inlet_class, packOSC_inlet_float);
+    class_addsymbol(packOSC_inlet_class, packOSC_inlet_symbol);
     class_addmethod(packOSC_class, (t_method)packOSC_path,
         gensym("prefix"), A_DEFSYM, 0);
+    class_addmethod(packOSC_class, (t_method)packOSC_setautobundle,
+        gensym("autobundle"), A_FLOAT, A_DEFFLOAT, 0);
+    class_addmethod(packOSC_class, (t_method)packOSC_sendarray,
+        gensym("sendarray"), A_GIMME, 0);
+    class_addmethod(packOSC_class, (t_method)packOSC_setdedupe,
+        gensym("dedupe"), A_FLOAT, A_DEFFLOAT, 0);
+    class_addmethod(packOSC_class, (t_method)packOSC_setmaxpacket,
+        gensym("maxpacket"), A_FLOAT, 0);
     class_addmethod(packOSC_class, (t_method)packOSC_settypetags,
         gensym("typetags"), A_DEFFLOAT, 0);
     class_addmethod(packOSC_class, (t_method)packOSC_setbufsize,
@@ -588,6 +1442,8 @@ void packOSC_setup(void)
         gensym("usepdtime"), A_FLOAT, 0);
     class_addmethod(packOSC_class, (t_method)packOSC_setTimeTagOffset,
         gensym("timetagoffset"), A_DEFFLOAT, 0);
+    class_addmethod(packOSC_class, (t_method)packOSC_stats,
+        gensym("stats"), 0, 0);
     class_addmethod(packOSC_class, (t_method)packOSC_send,
         gensym("send"), A_GIMME, 0);
     class_addmethod(packOSC_class, (t_method)packOSC_send,
@@ -609,8 +1465,10 @@ static typedArg packOSC_parseatom(t_atom *a, t_packOSC *x)
     t_symbol s;
     char     buf[MAXPDSTRING];
 
+#if DEBUG
     atom_string(a, buf, MAXPDSTRING);
     debugprint("packOSC: atom type %d (%s)\n", a->a_type, buf);
+#endif
     /* It might be an int, a float, or a string */
     switch (a->a_type)
     {
@@ -642,35 +1500,103 @@ static typedArg packOSC_parseatom(t_atom *a, t_packOSC *x)
     }
 }
 
-static typedArg packOSC_blob(t_atom *a, t_packOSC *x)
-{ /* ctype is one of i,f,s,T,F,N,I*/
+static typedArg packOSC_force64(t_atom *a, char ctype, t_packOSC *x)
+{ /* ctype is h or t, a is OSC_INT64_ATOMS atoms */
     typedArg    returnVal;
-    t_float     f;
+#if PD_FLOATSIZE == 64
+    /* h is an integer, t is seconds since 1900 */
+    double      f, seconds;
+
+    if (a->a_type == A_SYMBOL && ctype == 'h')
+    { /* a symbol can hold all 64 bits */
+        returnVal.type = INT64_osc;
+        returnVal.datum.h = (uint64_t)strtoll(a->a_w.w_symbol->s_name, NULL, 0);
+        return returnVal;
+    }
+    f = (a->a_type == A_SYMBOL)?atof(a->a_w.w_symbol->s_name):atom_getfloat(a);
+    returnVal.type = INT64_osc;
+    if (ctype == 'h') returnVal.datum.h = (uint64_t)(int64_t)f;
+    else
+    {
+        seconds = (f > 0)?floor(f):0;
+        returnVal.datum.h = ((uint64_t)(uint32_t)seconds << 32)
+            | (uint32_t)((f-seconds)*4294967296.0);
+    }
+#else
+    /* a 32-bit float can't hold 64 bits, so they come as four 16-bit pieces */
+    t_float     piece;
     int         i;
 
-    returnVal.type = NOTYPE_osc;
-    returnVal.datum.s = NULL;
-    /* the atoms must all be bytesl */
-    if(a->a_type != A_FLOAT)
+    returnVal.type = INT64_osc;
+    returnVal.datum.h = 0;
+    for (i = 0; i < OSC_INT64_ATOMS; ++i)
     {
-        pd_error(x, "packOSC_blob: all values must be floats");
-        return returnVal;
+        piece = (a[i].a_type == A_SYMBOL)?atof(a[i].a_w.w_symbol->s_name):atom_getfloat(&a[i]);
+        if (!(piece >= -32768 && piece <= 65535))
+            pd_error(x, "packOSC: %c: piece %d (%g) is outside -32768 to 65535", ctype, i+1, piece);
+        else returnVal.datum.h |= (uint64_t)(uint16_t)(int32_t)piece << (48-16*i);
     }
-    f = atom_getfloat(a);
-    i = (int)f;
-    if (i != f)
+#endif
+    debugprint("packOSC_force64: %c %llx\n", ctype, (unsigned long long)returnVal.datum.h);
+    (void)x;
+    return returnVal;
+}
+
+static int packOSC_blobargs(t_packOSC *x, int argc, t_atom *argv, unsigned int *argvIndex, int last, typedArg *arg)
+{
+/* Take the bytes of a blob argument from argv, starting at *argvIndex: either
+   'blob <n>' followed by n bytes, or a byte count followed by the bytes, or,
+   for the last argument, all the remaining atoms. A last argument whose first
+   atom is the number of atoms after it is read as a count too. */
+    int i = *argvIndex, n;
+
+    if (argv[i].a_type == A_SYMBOL && argv[i].a_w.w_symbol == gensym("blob"))
     {
-        pd_error(x, "packOSC_blob: all values must be whole numbers");
-        return returnVal;
+        if (i+1 >= argc || argv[i+1].a_type != A_FLOAT)
+        {
+            pd_error(x, "packOSC: blob needs a byte count");
+            return 1;
+        }
+        n = (int)argv[i+1].a_w.w_float;
+        i += 2;
     }
-    if ((i < -128) || (i > 255))
+    else if (!last || (argv[i].a_type == A_FLOAT && argv[i].a_w.w_float == argc-i-1))
     {
-        pd_error(x, "packOSC_blob: all values must be bytes");
-        return returnVal;
+        if (argv[i].a_type != A_FLOAT)
+        {
+            pd_error(x, "packOSC: blob needs a byte count");
+            return 1;
+        }
+        n = (int)argv[i].a_w.w_float;
+        i += 1;
     }
-    returnVal.type = BLOB_osc;
-    returnVal.datum.i = i;
-    return returnVal;
+    else n = argc-i;
+    if (n < 0 || n > argc-i)
+    {
+        pd_error(x, "packOSC: blob of %d bytes, only %d arguments left", n, argc-i);
+        return 1;
+    }
+    if (packOSC_blob(&argv[i], n, x)) return 1;
+    arg->type = BLOB_osc;
+    arg->datum.b.argv = &argv[i];
+    arg->datum.b.n = n;
+    *argvIndex = i+n;
+    return 0;
+}
+
+static int packOSC_blob(const t_atom *a, int n, t_packOSC *x)
+{ /* check that the n atoms at a are all bytes */
+    int i = OSC_atomsToBytes(NULL, a, n);
+
+    if (i < 0) return 0;
+    a += i;
+    if(a->a_type != A_FLOAT)
+        pd_error(x, "packOSC_blob: all values must be floats");
+    else if (!(a->a_w.w_float >= -128 && a->a_w.w_float <= 255))
+        pd_error(x, "packOSC_blob: all values must be bytes");
+    else
+        pd_error(x, "packOSC_blob: all values must be whole numbers");
+    return 1;
 }
 
 static typedArg packOSC_packMIDI(t_atom *a, t_packOSC *x)
@@ -747,6 +1673,11 @@ static typedArg packOSC_forceatom(t_atom *a, char ctype, t_packOSC *x)
                     returnVal.datum.f = atom_getfloat(a);
                     debugprint("packOSC_forceatom: float to float %f\n", returnVal.datum.f);
                     break;
+                case 'd':
+                    returnVal.type = DOUBLE_osc;
+                    returnVal.datum.d = atom_getfloat(a);
+                    debugprint("packOSC_forceatom: float to double %f\n", returnVal.datum.d);
+                    break;
                 case 's':
                     f = atom_getfloat(a);
                     sprintf(buf, "%f", f);
@@ -777,6 +1708,11 @@ static typedArg packOSC_forceatom(t_atom *a, char ctype, t_packOSC *x)
                     returnVal.datum.f = f;
                     debugprint("packOSC_forceatom: symbol to float %f\n", returnVal.datum.f);
                     break;
+                case 'd':
+                    returnVal.type = DOUBLE_osc;
+                    returnVal.datum.d = atof(s.s_name);
+                    debugprint("packOSC_forceatom: symbol to double %f\n", returnVal.datum.d);
+                    break;
                 case 's':
                     returnVal.type = STRING_osc;
                     returnVal.datum.s = s.s_name;
@@ -799,14 +1735,96 @@ static typedArg packOSC_forceatom(t_atom *a, char ctype, t_packOSC *x)
     return returnVal;
 }
 
+static size_t packOSC_messagesize(t_packOSC *x, t_packOSC_cached *address, int numArgs, typedArg *args, const char *typeStr)
+{
+/* the number of bytes the message will take in the packet, not counting the size count
+   in a bundle; typeStr is NULL for messages whose type tags come from the args */
+    size_t  size = address->c_addressLength;
+    int     j, numTags;
+
+    for (numTags = 0; numTags < numArgs; numTags++)
+    {
+        switch (args[numTags].type)
+        {
+            case INT_osc:
+            case FLOAT_osc:
+                size += 4;
+                break;
+            case STRING_osc:
+                size += OSC_effectiveStringLength(args[numTags].datum.s);
+                if (args[numTags].datum.s[0] == ',') size += 4; /* may need escaping */
+                break;
+            case BLOB_osc:
+                size += 4 + ((args[numTags].datum.b.n + 3) & ~3);
+                break;
+            case INT64_osc:
+            case DOUBLE_osc:
+                size += 8;
+                break;
+            default:
+                break;
+        }
+    }
+    if (typeStr != NULL) size += OSC_effectiveStringLength(typeStr);
+    else if (x->x_typetags)
+    { /* ',' and a tag for each arg */
+        j = numTags;
+        size += (j + 2 + 3) & ~3;
+    }
+    return size;
+}
+
+static int packOSC_patchmessage(t_packOSC *x, t_packOSC_cached *address, int numArgs, typedArg *args, char *typeStr)
+{
+/* A single message with only numeric arguments is sent straight from the
+   address cache: the argument words go right after the cached type tags,
+   where the last such message to this address still is, so only the 4-byte
+   slots are overwritten. typeStr is NULL if the type tags come from the args.
+   Returns 0 if the message has to be encoded in the OSCbuf. */
+    uint32_t    *slot;
+    intfloat32  if32;
+    size_t      length;
+    int         j;
+
+    if (x->x_bundle || x->x_autobundle || !OSC_isBufferEmpty(x->x_oscbuf)) return 0;
+    for (j = 0; j < numArgs; ++j)
+        if (args[j].type != INT_osc && args[j].type != FLOAT_osc) return 0; /* strings and blobs */
+    if (typeStr == NULL)
+    {
+        if (!x->x_typetags) return 0;
+        typeStr = x->x_typeStr; /* has room for number of args + ',' + '\0' */
+        typeStr[0] = ',';
+        for (j = 0; j < numArgs; ++j) typeStr[j+1] = (args[j].type == INT_osc)?'i':'f';
+        typeStr[j+1] = '\0';
+    }
+    if (packOSC_settypes(x, address, typeStr)) return 0;
+    length = address->c_headerLength + 4*numArgs;
+    if (packOSC_reserveheader(x, address, length)) return 0;
+    if (length > packOSC_packetlimit(x))
+        pd_error(x, "packOSC: %lu byte message is larger than maxpacket %lu",
+            (unsigned long)length, (unsigned long)packOSC_packetlimit(x));
+    slot = (uint32_t *)(address->c_header + address->c_headerLength);
+    for (j = 0; j < numArgs; ++j)
+    {
+        if (args[j].type == INT_osc) if32.i = args[j].datum.i;
+        else if32.f = args[j].datum.f;
+        slot[j] = htonl(if32.i);
+    }
+    if (x->x_dedupe && packOSC_isduplicate(x, address, address->c_header, address->c_header+length))
+        return 1;
+    packOSC_outputpacket(x, (unsigned char *)address->c_header, (int)length, 0);
+    return 1;
+}
+
 static int packOSC_writetypedmessage
-(t_packOSC *x, OSCbuf *buf, char *messageName, int numArgs, typedArg *args, char *typeStr)
+(t_packOSC *x, OSCbuf *buf, t_packOSC_cached *address, int numArgs, typedArg *args, char *typeStr)
 {
     int i, j, returnVal;
 
-    debugprint("packOSC_writetypedmessage: messageName %p (%s) typeStr %p (%s)\n",
-        messageName, messageName, typeStr, typeStr);
-    returnVal = OSC_writeAddressAndTypes(x, buf, messageName, typeStr);
+    debugprint("packOSC_writetypedmessage: address %p (%s) typeStr %p (%s)\n",
+        address, address->c_header, typeStr, typeStr);
+    if (packOSC_settypes(x, address, typeStr)) return 1;
+    returnVal = OSC_writeAddressAndTypes(x, buf, address->c_header, address->c_addressLength, address->c_headerLength);
 
     if (returnVal)
     {
@@ -833,14 +1851,22 @@ static int packOSC_writetypedmessage
                     debugprint("packOSC_writetypedmessage: float [%f]\n", args[j].datum.f);
                     returnVal = OSC_writeFloatArg(x, buf, args[j].datum.f);
                     break;
+                case INT64_osc:
+                    debugprint("packOSC_writetypedmessage: %c [%llx]\n", typeStr[i+1], (unsigned long long)args[j].datum.h);
+                    returnVal = OSC_writeInt64Arg(x, buf, typeStr[i+1], args[j].datum.h);
+                    break;
+                case DOUBLE_osc:
+                    debugprint("packOSC_writetypedmessage: double [%f]\n", args[j].datum.d);
+                    returnVal = OSC_writeDoubleArg(x, buf, args[j].datum.d);
+                    break;
                 case STRING_osc:
                     debugprint("packOSC_writetypedmessage: string [%s]\n", args[j].datum.s);
                     returnVal = OSC_writeStringArg(x, buf, args[j].datum.s);
                     break;
                 case BLOB_osc:
-                    /* write all the blob elements at once */
                     debugprint("packOSC_writetypedmessage calling OSC_writeBlobArg\n");
-                    return OSC_writeBlobArg(x, buf, &args[j], numArgs-j);
+                    returnVal = OSC_writeBlobArg(x, buf, args[j].datum.b.argv, args[j].datum.b.n);
+                    break;
                 default:
 
                     break; /* types with no data */
@@ -850,15 +1876,15 @@ static int packOSC_writetypedmessage
     return returnVal;
 }
 
-static int packOSC_writemessage(t_packOSC *x, OSCbuf *buf, char *messageName, int numArgs, typedArg *args)
+static int packOSC_writemessage(t_packOSC *x, OSCbuf *buf, t_packOSC_cached *address, int numArgs, typedArg *args)
 {
     int j, returnVal = 0, numTags;
-    debugprint("packOSC_writemessage buf %p bufptr %p messageName %s %d args typetags %d\n", buf, buf->bufptr, messageName, numArgs, x->x_typetags);
+    debugprint("packOSC_writemessage buf %p bufptr %p address %s %d args typetags %d\n", buf, buf->bufptr, address->c_header, numArgs, x->x_typetags);
 
     if (!x->x_typetags)
     {
         debugprint("packOSC_writemessage calling OSC_writeAddress with x->x_typetags %d\n", x->x_typetags);
-        returnVal = OSC_writeAddress(x, buf, messageName);
+        returnVal = OSC_writeAddress(x, buf, address->c_header, address->c_addressLength);
         if (returnVal)
         {
             pd_error(x, "packOSC: Problem writing address.");
@@ -866,14 +1892,10 @@ static int packOSC_writemessage(t_packOSC *x, OSCbuf *buf, char *messageName, in
     }
     else
     {
-        char *typeTags;
+        char *typeTags = x->x_typeStr; /* has room for number of args + ',' + '\0' */
 
         /* First figure out the type tags */
-        for (numTags = 0; numTags < numArgs; numTags++)
-        {
-            if (args[numTags].type == BLOB_osc) break; /* blob has one type tag and is the last element */
-        }
-        typeTags=(char*)getbytes(sizeof(char)*(numTags+2)); /* number of args + ',' + '\0' */
+        numTags = numArgs;
 
         typeTags[0] = ',';
         for (j = 0; j < numTags; ++j)
@@ -892,21 +1914,21 @@ static int packOSC_writemessage(t_packOSC *x, OSCbuf *buf, char *messageName, in
                 case BLOB_osc:
                     typeTags[j+1] = 'b';
                     break;
-                default:
+                default: /* no tag to write for it, so drop the whole message */
                     pd_error(x, "packOSC: arg %d type is unrecognized(%d)", j, args[j].type);
-                    break;
+                    return 1;
             }
         }
         typeTags[j+1] = '\0';
         debugprint("packOSC_writemessage calling OSC_writeAddressAndTypes with x->x_typetags %d typeTags %p (%s)\n", x->x_typetags, typeTags, typeTags);
-        returnVal = OSC_writeAddressAndTypes(x, buf, messageName, typeTags);
+        if (packOSC_settypes(x, address, typeTags)) returnVal = 1;
+        else returnVal = OSC_writeAddressAndTypes(x, buf, address->c_header, address->c_addressLength, address->c_headerLength);
         if (returnVal)
         {
             pd_error(x, "packOSC: Problem writing address.");
         }
-        freebytes(typeTags, sizeof(char)*(numTags+2));
     }
-    for (j = 0; j < numArgs; j++)
+    for (j = 0; j < numArgs && !returnVal; j++) /* stop at the first error, the message is dropped */
     {
         switch (args[j].type)
         {
@@ -921,9 +1943,11 @@ static int packOSC_writemessage(t_packOSC *x, OSCbuf *buf, char *messageName, in
                 break;
             case BLOB_osc:
                 debugprint("packOSC_writemessage calling OSC_writeBlobArg\n");
-                return OSC_writeBlobArg(x, buf, &args[j], numArgs-j); /* All the remaining args are blob */
+                returnVal = OSC_writeBlobArg(x, buf, args[j].datum.b.argv, args[j].datum.b.n);
+                break;
             default:
-                break; /* just skip bad types (which we won't get anyway unless this code is buggy) */
+                pd_error(x, "packOSC: arg %d type is unrecognized(%d)", j, args[j].type);
+                return 1;
         }
     }
     return returnVal;
@@ -931,21 +1955,6 @@ static int packOSC_writemessage(t_packOSC *x, OSCbuf *buf, char *messageName, in
 
 static void packOSC_sendbuffer(t_packOSC *x)
 {
-    int             i;
-    int             length;
-    unsigned char   *buf;
-    int             reentry_count=x->x_reentry_count;      /* must be on stack for recursion */
-    size_t          bufsize=sizeof(t_atom)*x->x_buflength; /* must be on stack for recursion */
-    t_atom          *atombuffer=x->x_bufferForOSClist;     /* must be on stack in the case of recursion */
-
-    if(reentry_count>0) /* if we are recurse, let's move atombuffer to the stack */
-        atombuffer=(t_atom *)getbytes(bufsize);
-
-    if(!atombuffer) {
-        pd_error(x, "packOSC: unable to allocate %lu bytes for atombuffer", (long)bufsize);
-        return;
-    }
-
     debugprint("packOSC_sendbuffer: Sending buffer...\n");
     if (OSC_isBufferEmpty(x->x_oscbuf))
     {
@@ -957,22 +1966,26 @@ static void packOSC_sendbuffer(t_packOSC *x)
         pd_error(x, "packOSC_sendbuffer() called but buffer not ready!, not exiting");
         return;
     }
-    length = OSC_packetSize(x->x_oscbuf);
-    buf = (unsigned char *)OSC_getPacket(x->x_oscbuf);
-    debugprint("packOSC_sendbuffer: length: %u\n", length);
-
-    /* convert the bytes in the buffer to floats in a list */
-    for (i = 0; i < length; ++i) SETFLOAT(&atombuffer[i], buf[i]);
+    packOSC_outputpacket(x, (unsigned char *)OSC_getPacket(x->x_oscbuf), OSC_packetSize(x->x_oscbuf), 1);
+}
 
-    /* cleanup the OSCbuffer structure (so we are ready for recursion) */
-    OSC_initBuffer(x->x_oscbuf, x->x_buflength, x->x_bufferForOSCbuf);
+static void packOSC_outputpacket(t_packOSC *x, const unsigned char *buf, int length, int fromOSCbuf)
+{
+/* output length bytes from buf as a list of floats. If fromOSCbuf is nonzero
+   buf is our OSCbuf, which is cleared before the list goes out. */
+    t_atom          *atombuffer;                           /* must be on stack in the case of recursion */
 
-    /* send the list out the outlet */
-    outlet_list(x->x_listout, &s_list, length, atombuffer);
+    debugprint("packOSC_outputpacket: length: %u\n", length);
+    atombuffer = packOSC_shared_atoms(x, x->x_shared, buf, length);
 
-    /* cleanup our 'stack'-allocated atombuffer in the case of reentrancy */
-    if(reentry_count>0)
-        freebytes(atombuffer, bufsize);
+    if (fromOSCbuf)
+    {
+        /* cleanup the OSCbuffer structure (so we are ready for recursion) */
+        OSC_initBuffer(x->x_oscbuf, x->x_buflength, x->x_bufferForOSCbuf);
+        /* if this was part of a split bundle the rest of it goes into the buffer now */
+        if (x->x_splitDepth) packOSC_reopenbundles(x);
+    }
+    if (atombuffer != NULL) packOSC_shared_output(x->x_shared, x->x_listout, atombuffer, length);
 }
 
 /* The next part is copied and morphed from OSC-client.c. */
@@ -1097,7 +2110,7 @@ static int OSC_openBundle(void *x, OSCbuf *buf, OSCTimeTag tt)
     }
 
     buf->bufptr += OSC_padString(buf->bufptr, "#bundle");
-
+    buf->timeTags[buf->bundleDepth] = tt;
 
     *((OSCTimeTag *) buf->bufptr) = tt;
 
@@ -1158,10 +2171,9 @@ static int OSC_closeBundle(void *x, OSCbuf *buf)
     return 0;
 }
 
-static int OSC_writeAddress(void *x, OSCbuf *buf, char *name)
-{
-    uint32_t paddedLength;
-    debugprint("-->OSC_writeAddress buf %p bufptr %p name %s\n", buf, buf->bufptr, name);
+static int OSC_writeAddress(void *x, OSCbuf *buf, const char *padded, int paddedLength)
+{ /* padded is the address, already padded to paddedLength bytes */
+    debugprint("-->OSC_writeAddress buf %p bufptr %p name %s\n", buf, buf->bufptr, padded);
     if (buf->state == ONE_MSG_ARGS)
     {
         pd_error(x, "packOSC: This packet is not a bundle, so you can't write another address");
@@ -1176,7 +2188,6 @@ static int OSC_writeAddress(void *x, OSCbuf *buf, char *name)
 
     if (CheckTypeTag(x, buf, '\0')) return 9;
 
-    paddedLength = OSC_effectiveStringLength(name);
     debugprint("OSC_writeAddress paddedLength %d\n", paddedLength);
 
     if (buf->state == EMPTY)
@@ -1201,32 +2212,33 @@ static int OSC_writeAddress(void *x, OSCbuf *buf, char *name)
     }
 
     /* Now write the name */
-    buf->bufptr += OSC_padString(buf->bufptr, name);
+    memcpy(buf->bufptr, padded, paddedLength);
+    buf->bufptr += paddedLength;
     buf->typeStringPtr = 0;
     buf->gettingFirstUntypedArg = 1;
 
     return 0;
 }
 
-static int OSC_writeAddressAndTypes(void *x, OSCbuf *buf, char *name, char *types)
-{
+static int OSC_writeAddressAndTypes(void *x, OSCbuf *buf, const char *padded, int addressLength, int paddedLength)
+{ /* padded is the padded address followed by the padded type string, paddedLength bytes in all */
     int      result;
-    uint32_t paddedLength;
 
-    debugprint("OSC_writeAddressAndTypes buf %p name %s types %s\n", buf, name, types);
+    debugprint("OSC_writeAddressAndTypes buf %p name %s types %s\n", buf, padded, padded+addressLength);
     if (buf == NULL) return 10;
     if (CheckTypeTag(x, buf, '\0')) return 9;
 
-    result = OSC_writeAddress(x, buf, name);
+    result = OSC_writeAddress(x, buf, padded, addressLength);
 
     if (result) return result;
 
-    paddedLength = OSC_effectiveStringLength(types);
+    paddedLength -= addressLength;
 
     if(OSC_CheckOverflow(x, buf, paddedLength))return 1;
 
     buf->typeStringPtr = buf->bufptr + 1; /* skip comma */
-    buf->bufptr += OSC_padString(buf->bufptr, types);
+    memcpy(buf->bufptr, padded+addressLength, paddedLength);
+    buf->bufptr += paddedLength;
     debugprint("OSC_writeAddressAndTypes buf->typeStringPtr now %p (%s) buf->bufptr now %p (%s)\n",
         buf->typeStringPtr, buf->typeStringPtr, buf->bufptr, buf->bufptr);
 
@@ -1303,32 +2315,91 @@ static int OSC_writeIntArg(void *x, OSCbuf *buf, uint32_t arg)
     return 0;
 }
 
-static int OSC_writeBlobArg(void *x, OSCbuf *buf, typedArg *arg, size_t nArgs)
+static int OSC_writeInt64Arg(void *x, OSCbuf *buf, char type, uint64_t arg)
 {
-    size_t i;
-    unsigned char b;
+    if(OSC_CheckOverflow(x, buf, 8))return 1;
+    if (CheckTypeTag(x, buf, type)) return 9;
+
+    ((uint32_t *) buf->bufptr)[0] = htonl((uint32_t)(arg >> 32));
+    ((uint32_t *) buf->bufptr)[1] = htonl((uint32_t)arg);
+    buf->bufptr += 8;
 
-/* pack all the args as single bytes following a 4-byte length */
-    if(OSC_CheckOverflow(x, buf, nArgs+4))return 1;
+    buf->gettingFirstUntypedArg = 0;
+    return 0;
+}
+
+static int OSC_writeDoubleArg(void *x, OSCbuf *buf, double arg)
+{
+    intfloat64 if64;
+
+    if(OSC_CheckOverflow(x, buf, 8))return 1;
+    if (CheckTypeTag(x, buf, 'd')) return 9;
+
+    if64.d = arg;
+    ((uint32_t *) buf->bufptr)[0] = htonl((uint32_t)(if64.i >> 32));
+    ((uint32_t *) buf->bufptr)[1] = htonl((uint32_t)if64.i);
+    buf->bufptr += 8;
+
+    buf->gettingFirstUntypedArg = 0;
+    return 0;
+}
+
+static int OSC_writeBlobArg(void *x, OSCbuf *buf, const t_atom *argv, int n)
+{
+    int i;
+
+/* pack the atoms as single bytes following a 4-byte length, they were checked by packOSC_blob() */
+    if(OSC_CheckOverflow(x, buf, 4+(((size_t)n+3) & ~(size_t)3)))return 1;
     if (CheckTypeTag(x, buf, 'b')) return 9;
 
-    *((uint32_t *) buf->bufptr) = htonl(nArgs);
-    debugprint("OSC_writeBlobArg length : %lu\n", nArgs);
+    *((uint32_t *) buf->bufptr) = htonl(n);
+    debugprint("OSC_writeBlobArg length : %d\n", n);
     buf->bufptr += 4;
 
-    for (i = 0; i < nArgs; i++)
+    OSC_atomsToBytes((unsigned char *)buf->bufptr, argv, n);
+    i = OSC_WriteBlobPadding(buf->bufptr, n);
+    buf->bufptr += i;
+    buf->gettingFirstUntypedArg = 0;
+    return 0;
+}
+
+static int OSC_writeFloatRun(void *x, OSCbuf *buf, const t_word *vec, int n)
+{
+/* write n floats from an array in one go */
+    uint32_t    *out;
+    intfloat32  if32;
+    int         i;
+
+    if(OSC_CheckOverflow(x, buf, 4*(size_t)n))return 1;
+    out = (uint32_t *)buf->bufptr;
+    for (i = 0; i < n; ++i)
+    {
+        if32.f = vec[i].w_float;
+        out[i] = htonl(if32.i);
+    }
+    buf->bufptr += 4*n;
+    buf->gettingFirstUntypedArg = 0;
+    return 0;
+}
+
+static int OSC_writeBlobRun(void *x, OSCbuf *buf, const t_word *vec, int n)
+{
+/* write n bytes from an array as a blob */
+    int i, b;
+
+    if(OSC_CheckOverflow(x, buf, 4+(((size_t)n+3) & ~(size_t)3)))return 1;
+    *((uint32_t *) buf->bufptr) = htonl(n);
+    for (i = 0; i < n; ++i)
     {
-        if (arg[i].type != BLOB_osc)
+        if (!(vec[i].w_float >= -128 && vec[i].w_float <= 255) || (b = (int)vec[i].w_float) != vec[i].w_float)
         {
-            pd_error(x, "packOSC: blob element %lu not blob type", (long unsigned)i);
+            pd_error(x, "packOSC: blob element %d is not a byte", i);
             return 9;
         }
-        b = (unsigned char)((arg[i].datum.i)&0x0FF);/* force int to 8-bit byte */
-        debugprint("OSC_writeBlobArg : %d, %d\n", arg[i].datum.i, b);
-        buf->bufptr[i] = b;
+        buf->bufptr[4+i] = (char)(b&0x0FF);
     }
-    i = OSC_WriteBlobPadding(buf->bufptr, i);
-    buf->bufptr += i;
+    buf->bufptr += 4;
+    buf->bufptr += OSC_WriteBlobPadding(buf->bufptr, n);
     buf->gettingFirstUntypedArg = 0;
     return 0;
 }
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
 #ifdef _WIN32
 # include <winsock2.h>
 #else
@@ -24,6 +26,210 @@ typedef union
     float   f;
 } intfloat32;
 
+typedef union
+{
+    uint64_t    i;
+    double      d;
+} intfloat64;
+
+/* The 64-bit OSC types h and t fit in a single double-precision t_float,
+   otherwise they are split into four atoms of 16 bits each, most significant
+   first, which a 32-bit float holds exactly. For h the first one is signed.
+   d becomes a single t_float either way. */
+#if PD_FLOATSIZE == 64
+# define OSC_INT64_ATOMS 1
+#else
+# define OSC_INT64_ATOMS 4
+#endif
+
+
+/* OSC packets travel through Pd as lists of floats, one per byte. These
+   convert between the two, a vector at a time where the compiler targets SSE2
+   or NEON and the atoms have the usual 16-byte layout (a 4-byte type, padding,
+   then the t_float), and one at a time otherwise. */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define OSC_SSE2 1
+#elif (defined(__ARM_NEON) && defined(__AARCH64EL__)) || defined(_M_ARM64)
+# include <arm_neon.h>
+# define OSC_NEON 1
+#endif
+#include <stddef.h>
+#define OSC_VECTOR_ATOMS (sizeof(t_atom) == 16 && offsetof(t_atom, a_w) == 8)
+
+#if OSC_SSE2
+static inline void OSC_storeAtoms4(t_atom *out, __m128i v)
+{
+/* store the four ints in v as float atoms */
+    const __m128i type = _mm_set_epi32(0, A_FLOAT, 0, A_FLOAT);
+# if PD_FLOATSIZE == 64
+    __m128i lo = _mm_castpd_si128(_mm_cvtepi32_pd(v));
+    __m128i hi = _mm_castpd_si128(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)));
+# else
+    __m128i f = _mm_castps_si128(_mm_cvtepi32_ps(v));
+    __m128i lo = _mm_unpacklo_epi32(f, _mm_setzero_si128());
+    __m128i hi = _mm_unpackhi_epi32(f, _mm_setzero_si128());
+# endif
+    _mm_storeu_si128((__m128i *)&out[0], _mm_unpacklo_epi64(type, lo));
+    _mm_storeu_si128((__m128i *)&out[1], _mm_unpackhi_epi64(type, lo));
+    _mm_storeu_si128((__m128i *)&out[2], _mm_unpacklo_epi64(type, hi));
+    _mm_storeu_si128((__m128i *)&out[3], _mm_unpackhi_epi64(type, hi));
+}
+
+static inline __m128i OSC_loadAtoms4(const t_atom *in, __m128i *ok)
+{
+/* return the four atoms at in as ints, clearing the lanes of ok
+   that are not floats holding whole numbers on [-128..255] */
+    __m128 x01, x23, whole;
+    __m128i types, v;
+# if PD_FLOATSIZE == 64
+    __m128i a0 = _mm_loadu_si128((const __m128i *)&in[0]);
+    __m128i a1 = _mm_loadu_si128((const __m128i *)&in[1]);
+    __m128i a2 = _mm_loadu_si128((const __m128i *)&in[2]);
+    __m128i a3 = _mm_loadu_si128((const __m128i *)&in[3]);
+    __m128d d01 = _mm_castsi128_pd(_mm_unpackhi_epi64(a0, a1));
+    __m128d d23 = _mm_castsi128_pd(_mm_unpackhi_epi64(a2, a3));
+    __m128i v01 = _mm_cvttpd_epi32(d01), v23 = _mm_cvttpd_epi32(d23);
+
+    x01 = _mm_castsi128_ps(_mm_unpacklo_epi64(a0, a1));
+    x23 = _mm_castsi128_ps(_mm_unpacklo_epi64(a2, a3));
+    types = _mm_castps_si128(_mm_shuffle_ps(x01, x23, _MM_SHUFFLE(2, 0, 2, 0)));
+    v = _mm_unpacklo_epi64(v01, v23);
+    whole = _mm_shuffle_ps(_mm_castpd_ps(_mm_cmpeq_pd(_mm_cvtepi32_pd(v01), d01)),
+        _mm_castpd_ps(_mm_cmpeq_pd(_mm_cvtepi32_pd(v23), d23)), _MM_SHUFFLE(2, 0, 2, 0));
+# else
+    __m128 f;
+
+    /* (type, float) pairs, then all the types and all the floats */
+    x01 = _mm_shuffle_ps(_mm_loadu_ps((const float *)&in[0]), _mm_loadu_ps((const float *)&in[1]),
+        _MM_SHUFFLE(2, 0, 2, 0));
+    x23 = _mm_shuffle_ps(_mm_loadu_ps((const float *)&in[2]), _mm_loadu_ps((const float *)&in[3]),
+        _MM_SHUFFLE(2, 0, 2, 0));
+    types = _mm_castps_si128(_mm_shuffle_ps(x01, x23, _MM_SHUFFLE(2, 0, 2, 0)));
+    f = _mm_shuffle_ps(x01, x23, _MM_SHUFFLE(3, 1, 3, 1));
+    v = _mm_cvttps_epi32(f);
+    whole = _mm_cmpeq_ps(_mm_cvtepi32_ps(v), f);
+# endif
+    *ok = _mm_and_si128(*ok, _mm_and_si128(_mm_cmpeq_epi32(types, _mm_set1_epi32(A_FLOAT)),
+        _mm_castps_si128(whole)));
+    *ok = _mm_and_si128(*ok, _mm_and_si128(_mm_cmpgt_epi32(v, _mm_set1_epi32(-129)),
+        _mm_cmplt_epi32(v, _mm_set1_epi32(256))));
+    return _mm_and_si128(v, _mm_set1_epi32(0xFF));
+}
+#elif OSC_NEON && PD_FLOATSIZE != 64
+static inline void OSC_storeAtoms4(t_atom *out, uint32x4_t v)
+{
+/* store the four ints in v as float atoms */
+    const uint32x2_t type = vcreate_u32(A_FLOAT);
+    uint32x4x2_t f = vzipq_u32(vreinterpretq_u32_f32(vcvtq_f32_u32(v)), vdupq_n_u32(0));
+
+    vst1q_u32((uint32_t *)&out[0], vcombine_u32(type, vget_low_u32(f.val[0])));
+    vst1q_u32((uint32_t *)&out[1], vcombine_u32(type, vget_high_u32(f.val[0])));
+    vst1q_u32((uint32_t *)&out[2], vcombine_u32(type, vget_low_u32(f.val[1])));
+    vst1q_u32((uint32_t *)&out[3], vcombine_u32(type, vget_high_u32(f.val[1])));
+}
+
+static inline uint16x4_t OSC_loadAtoms4(const t_atom *in, uint32x4_t *ok)
+{
+/* return the four atoms at in as bytes, clearing the lanes of ok
+   that are not floats holding whole numbers on [-128..255] */
+    uint32x4x4_t a = vld4q_u32((const uint32_t *)in); /* types in val[0], floats in val[2] */
+    float32x4_t f = vreinterpretq_f32_u32(a.val[2]);
+    int32x4_t v = vcvtq_s32_f32(f);
+
+    *ok = vandq_u32(*ok, vandq_u32(vceqq_u32(a.val[0], vdupq_n_u32(A_FLOAT)),
+        vceqq_f32(vcvtq_f32_s32(v), f)));
+    *ok = vandq_u32(*ok, vandq_u32(vcgeq_s32(v, vdupq_n_s32(-128)), vcleq_s32(v, vdupq_n_s32(255))));
+    return vmovn_u32(vandq_u32(vreinterpretq_u32_s32(v), vdupq_n_u32(0xFF)));
+}
+#endif
+
+static void OSC_bytesToAtoms(t_atom *out, const unsigned char *in, int n)
+{
+/* set the n atoms at out to the floats on [0..255] of the n bytes at in */
+    int i = 0;
+
+#if OSC_SSE2
+    if (OSC_VECTOR_ATOMS)
+    {
+        const __m128i zero = _mm_setzero_si128();
+
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i b = _mm_loadu_si128((const __m128i *)(in+i));
+            __m128i lo = _mm_unpacklo_epi8(b, zero), hi = _mm_unpackhi_epi8(b, zero);
+
+            OSC_storeAtoms4(out+i, _mm_unpacklo_epi16(lo, zero));
+            OSC_storeAtoms4(out+i+4, _mm_unpackhi_epi16(lo, zero));
+            OSC_storeAtoms4(out+i+8, _mm_unpacklo_epi16(hi, zero));
+            OSC_storeAtoms4(out+i+12, _mm_unpackhi_epi16(hi, zero));
+        }
+    }
+#elif OSC_NEON && PD_FLOATSIZE != 64
+    if (OSC_VECTOR_ATOMS)
+    {
+        for (; i + 16 <= n; i += 16)
+        {
+            uint8x16_t b = vld1q_u8(in+i);
+            uint16x8_t lo = vmovl_u8(vget_low_u8(b)), hi = vmovl_u8(vget_high_u8(b));
+
+            OSC_storeAtoms4(out+i, vmovl_u16(vget_low_u16(lo)));
+            OSC_storeAtoms4(out+i+4, vmovl_u16(vget_high_u16(lo)));
+            OSC_storeAtoms4(out+i+8, vmovl_u16(vget_low_u16(hi)));
+            OSC_storeAtoms4(out+i+12, vmovl_u16(vget_high_u16(hi)));
+        }
+    }
+#endif
+    for (; i < n; ++i) SETFLOAT(&out[i], in[i]);
+}
+
+static int OSC_atomsToBytes(unsigned char *out, const t_atom *in, int n)
+{
+/* Store the n atoms at in as bytes at out, or just check them if out is NULL.
+   Each one must be a float holding a whole number on [-128..255]. Returns the
+   index of the first one that isn't, or -1 if they all are. */
+    int i = 0, j;
+
+#if OSC_SSE2
+    if (OSC_VECTOR_ATOMS)
+    {
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i ok = _mm_set1_epi32(-1);
+            __m128i v0 = OSC_loadAtoms4(in+i, &ok), v1 = OSC_loadAtoms4(in+i+4, &ok);
+            __m128i v2 = OSC_loadAtoms4(in+i+8, &ok), v3 = OSC_loadAtoms4(in+i+12, &ok);
+
+            if (_mm_movemask_epi8(ok) != 0xFFFF) break; /* find it below */
+            if (out) _mm_storeu_si128((__m128i *)(out+i),
+                _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3)));
+        }
+    }
+#elif OSC_NEON && PD_FLOATSIZE != 64
+    if (OSC_VECTOR_ATOMS)
+    {
+        for (; i + 16 <= n; i += 16)
+        {
+            uint32x4_t ok = vdupq_n_u32(0xFFFFFFFF);
+            uint16x4_t v0 = OSC_loadAtoms4(in+i, &ok), v1 = OSC_loadAtoms4(in+i+4, &ok);
+            uint16x4_t v2 = OSC_loadAtoms4(in+i+8, &ok), v3 = OSC_loadAtoms4(in+i+12, &ok);
+
+            if (vminvq_u32(ok) != 0xFFFFFFFF) break; /* find it below */
+            if (out) vst1q_u8(out+i, vcombine_u8(vmovn_u16(vcombine_u16(v0, v1)),
+                vmovn_u16(vcombine_u16(v2, v3))));
+        }
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        if (in[i].a_type != A_FLOAT) return i;
+        /* range first, converting NaN or a huge value to int is undefined */
+        if (!(in[i].a_w.w_float >= -128 && in[i].a_w.w_float <= 255)) return i;
+        j = (int)in[i].a_w.w_float;
+        if (j != in[i].a_w.w_float) return i;
+        if (out) out[i] = (unsigned char)j;
+    }
+    return -1;
+}
 
 #undef debug
 #if DEBUG
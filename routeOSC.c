@@ -83,23 +83,100 @@ The OpenSound Control WWW page is
 /* the required include files */
 #include "m_pd.h"
 
-#define MAX_NUM 128 // maximum number of paths (prefixes) we can route
+#include <string.h>
+
+#define ROUTEOSC_STACK_MATCHES 32 // matches collected without allocating
+#define ROUTEOSC_STACK_ATOMS 64 // atoms of a -dispatch output built without allocating
+#define ROUTEOSC_STACK_STATES 256 // words of matcher state used without allocating
+#define ROUTEOSC_COMPILED_SIZE 16 // compiled address patterns kept, must be a power of 2
+#define ROUTEOSC_MEMO_SIZE 64 // incoming addresses whose matches are remembered, must be a power of 2
+
+/* the kinds of token an address pattern compiles to */
+#define ROUTEOSC_CHAR 0 /* one particular character */
+#define ROUTEOSC_ANY 1 /* ? */
+#define ROUTEOSC_STAR 2 /* * */
+#define ROUTEOSC_SET 3 /* [...] */
+#define ROUTEOSC_LIST 4 /* {...,...} */
+
+/* 32-bit FNV-1a, for hashing prefixes one character at a time */
+#define ROUTEOSC_HASH_BASIS 2166136261u
+#define ROUTEOSC_HASH_PRIME 16777619u
+
+typedef struct _routeOSC_prefix
+{
+    unsigned int    p_hash; /* hash of the prefix without its leading slash */
+    int             p_length; /* length of the prefix without its leading slash */
+    int             p_next; /* next prefix in the same hash bucket, in order, or -1. For a free slot, the next free slot */
+    int             p_generic; /* non-zero if the prefix is in x_generic rather than x_buckets */
+} t_routeOSC_prefix;
+
+typedef struct _routeOSC_token
+{
+    int             t_type; /* ROUTEOSC_CHAR, _ANY, _STAR, _SET or _LIST */
+    char            t_char; /* for ROUTEOSC_CHAR */
+    unsigned int    t_set[8]; /* for ROUTEOSC_SET, bit c is on if character c matches */
+    const char      *t_list; /* for ROUTEOSC_LIST, the alternatives separated by commas */
+    int             t_listlength;
+} t_routeOSC_token;
+
+typedef struct _routeOSC_compiled
+{
+    t_symbol        *c_symbol; /* the incoming address, or NULL if this is empty */
+    int             c_depth; /* the number of its levels that were compiled */
+    int             c_valid; /* zero if it has a syntax error and can't match anything */
+    char            *c_string; /* those levels without the leading slash */
+    size_t          c_stringsize;
+    t_routeOSC_token *c_tokens;
+    int             c_ntokens;
+    size_t          c_tokensize;
+} t_routeOSC_compiled;
+
+typedef struct _routeOSC_memo
+{
+    t_symbol        *m_symbol; /* the incoming address, or NULL if this is empty */
+    int             m_nmatches;
+    int             *m_matches; /* the prefixes it matched, in order */
+    t_symbol        **m_rest; /* for each of them the rest of the address, or NULL */
+    int             m_size; /* number of matches there is room for */
+} t_routeOSC_memo;
 
 typedef struct _routeOSC
 {
     t_object    x_obj; /* required header */
-    int         x_num; /* Number of prefixes we store */
+    int         x_num; /* Number of prefixes we store, including free slots */
+    int         x_size; /* number of prefixes there is room for */
+    int         x_nroutes; /* number of prefixes in use */
+    int         x_free; /* the first free slot, or -1 */
     int         x_verbosity; /* level of debug output required */
-    const char  **x_prefixes; /* the OSC addresses to be matched */
+    t_symbol    **x_prefixes; /* the OSC addresses to be matched, NULL for a free slot */
     int         *x_prefix_depth; /* the number of slashes in each prefix */
-    void        **x_outlets; /* one for each prefix plus one for everything else */
+    int         x_dispatch; /* non-zero if all matches go out one outlet, with their prefix as the selector */
+    void        **x_outlets; /* one for each prefix (or one for all of them with -dispatch) plus one for everything else */
+    int         x_noutlets;
+    void        *x_reject; /* the last outlet, for everything else */
+    t_canvas    *x_canvas; /* for finding files to load */
+    /* An address without wildcards matches a prefix only if they are equal up to the
+       prefix's depth, so those are looked up in a hash table, one level at a time.
+       Only a prefix of a single star and addresses with wildcards need the pattern matcher. */
+    t_routeOSC_prefix *x_index; /* one for each prefix */
+    int         *x_buckets; /* first prefix in each bucket, or -1 */
+    int         x_nbuckets; /* a power of 2 */
+    int         *x_generic; /* the prefixes that aren't in x_buckets, in order */
+    int         x_ngeneric;
+    int         *x_depth_count; /* number of prefixes in x_buckets at each depth */
+    int         x_depth_size;
+    int         x_max_depth; /* the deepest prefix in x_buckets */
+    t_routeOSC_compiled *x_compiled; /* [ROUTEOSC_COMPILED_SIZE] recent address patterns */
+    t_routeOSC_memo *x_memo; /* [ROUTEOSC_MEMO_SIZE] the matches of recent addresses */
+    unsigned long x_memo_hits;
+    unsigned long x_memo_misses;
 } t_routeOSC;
 
 /* prototypes  */
 
 void routeOSC_setup(void);
 static void routeOSC_free(t_routeOSC *x);
-static int MyPatternMatch (void *x, const char *pattern, const char *test);
+static int MyPatternMatch (void *x, const t_routeOSC_compiled *pattern, const char *test);
 static void routeOSC_doanything(t_routeOSC *x, t_symbol *s, int argc, t_atom *argv);
 static void routeOSC_bang(t_routeOSC *x);
 static void routeOSC_float(t_routeOSC *x, t_floatarg f);
@@ -109,38 +186,71 @@ static void *routeOSC_new(t_symbol *s, int argc, t_atom *argv);
 static void routeOSC_set(t_routeOSC *x, t_symbol *s, int argc, t_atom *argv);
 static void routeOSC_paths(t_routeOSC *x);
 static void routeOSC_verbosity(t_routeOSC *x, t_floatarg v);
+static void routeOSC_stats(t_routeOSC *x);
+static void routeOSC_add(t_routeOSC *x, t_symbol *s, int argc, t_atom *argv);
+static void routeOSC_remove(t_routeOSC *x, t_symbol *s, int argc, t_atom *argv);
+static void routeOSC_load(t_routeOSC *x, t_symbol *filename);
+static int routeOSC_add_path(t_routeOSC *x, t_symbol *path);
+static int routeOSC_find(t_routeOSC *x, t_symbol *path);
+static int routeOSC_grow(t_routeOSC *x);
+static void routeOSC_clear(t_routeOSC *x);
+static void routeOSC_dispatch(t_routeOSC *x, int i, t_symbol *rest, int argc, t_atom *argv);
 static int routeOSC_count_slashes(const char *prefix);
+static void routeOSC_index(t_routeOSC *x);
+static void routeOSC_index_add(t_routeOSC *x, int i);
+static void routeOSC_index_remove(t_routeOSC *x, int i);
+static void routeOSC_forget(t_routeOSC *x);
+static unsigned int routeOSC_hash(const char *s);
+static int routeOSC_has_wildcards(const char *pattern);
+static int routeOSC_match(t_routeOSC *x, t_symbol *s, int pattern_depth, int *matches);
+static t_routeOSC_compiled *routeOSC_compile(t_routeOSC *x, t_symbol *s, int depth);
+static int routeOSC_lookup(t_routeOSC *x, t_symbol *s, int pattern_depth, int *matches, t_symbol **rest);
 static const char *NextSlashOrNull(const char *p);
 static const char *NthSlashOrNull(const char *p, int n);
 static void StrCopyUntilSlash(char *target, const char *source);
-static void StrCopyUntilNthSlash(char *target, const char *source, int n);
 
 /* from
     OSC-pattern-match.c
 */
-static const char *theWholePattern; /* Just for warning messages */
-static int MatchBrackets (void *x, const char *pattern, const char *test);
-static int MatchList (void *x, const char *pattern, const char *test);
-static int PatternMatch (void *x, const char *pattern, const char *test);
+static int PatternMatch (const t_routeOSC_compiled *pattern, const char *test);
 
 static t_class *routeOSC_class;
 t_symbol *ps_list, *ps_complain, *ps_emptySymbol;
 
-static int MyPatternMatch (void *x, const char *pattern, const char *test)
+static int MyPatternMatch (void *x, const t_routeOSC_compiled *pattern, const char *test)
 {
     // This allows the special case of "routeOSC /* " to be an outlet that
     // matches anything; i.e., it always outputs the input with the first level
     // of the address stripped off.
 
     if (test[0] == '*' && test[1] == '\0') return 1;
-    else return PatternMatch(x, pattern, test);
+    (void)x;
+    return PatternMatch(pattern, test);
 }
 
 static void routeOSC_free(t_routeOSC *x)
 {
-    freebytes(x->x_prefixes, x->x_num*sizeof(char *)); /* the OSC addresses to be matched */
-    freebytes(x->x_prefix_depth, x->x_num*sizeof(int));  /* the number of slashes in each prefix */
-    freebytes(x->x_outlets, (x->x_num+1)*sizeof(void *)); /* one for each prefix plus one for everything else */
+    int i;
+
+    freebytes(x->x_prefixes, x->x_size*sizeof(t_symbol *)); /* the OSC addresses to be matched */
+    freebytes(x->x_prefix_depth, x->x_size*sizeof(int));  /* the number of slashes in each prefix */
+    freebytes(x->x_outlets, x->x_noutlets*sizeof(void *));
+    freebytes(x->x_index, x->x_size*sizeof(t_routeOSC_prefix));
+    freebytes(x->x_buckets, x->x_nbuckets*sizeof(int));
+    freebytes(x->x_generic, x->x_size*sizeof(int));
+    freebytes(x->x_depth_count, x->x_depth_size*sizeof(int));
+    for (i = 0; i < ROUTEOSC_COMPILED_SIZE; ++i)
+    {
+        if (x->x_compiled[i].c_string) freebytes(x->x_compiled[i].c_string, x->x_compiled[i].c_stringsize);
+        if (x->x_compiled[i].c_tokens) freebytes(x->x_compiled[i].c_tokens, x->x_compiled[i].c_tokensize);
+    }
+    freebytes(x->x_compiled, ROUTEOSC_COMPILED_SIZE*sizeof(t_routeOSC_compiled));
+    for (i = 0; i < ROUTEOSC_MEMO_SIZE; ++i)
+    {
+        if (x->x_memo[i].m_matches) freebytes(x->x_memo[i].m_matches, x->x_memo[i].m_size*sizeof(int));
+        if (x->x_memo[i].m_rest) freebytes(x->x_memo[i].m_rest, x->x_memo[i].m_size*sizeof(t_symbol *));
+    }
+    freebytes(x->x_memo, ROUTEOSC_MEMO_SIZE*sizeof(t_routeOSC_memo));
 }
 
 /* initialization routine */
@@ -157,6 +267,10 @@ void routeOSC_setup(void)
     class_addmethod(routeOSC_class, (t_method)routeOSC_set, gensym("set"), A_GIMME, 0);
     class_addmethod(routeOSC_class, (t_method)routeOSC_paths, gensym("paths"), 0);
     class_addmethod(routeOSC_class, (t_method)routeOSC_verbosity, gensym("verbosity"), A_DEFFLOAT, 0);
+    class_addmethod(routeOSC_class, (t_method)routeOSC_stats, gensym("stats"), 0);
+    class_addmethod(routeOSC_class, (t_method)routeOSC_add, gensym("add"), A_GIMME, 0);
+    class_addmethod(routeOSC_class, (t_method)routeOSC_remove, gensym("remove"), A_GIMME, 0);
+    class_addmethod(routeOSC_class, (t_method)routeOSC_load, gensym("load"), A_SYMBOL, 0);
 
     ps_emptySymbol = gensym("");
 
@@ -171,12 +285,13 @@ static void *routeOSC_new(t_symbol *s, int argc, t_atom *argv)
     t_routeOSC *x = (t_routeOSC *)pd_new(routeOSC_class);   // get memory for a new object & initialize
     int i;
 
-    if (argc > MAX_NUM)
-    {
-        pd_error(x, "* %s: too many arguments: %d (max %d)", s->s_name, argc, MAX_NUM);
-        return 0;
-    }
     x->x_num = 0;
+    if (argc && argv[0].a_type == A_SYMBOL && !strcmp(argv[0].a_w.w_symbol->s_name, "-dispatch"))
+    { /* one outlet for all the prefixes, which can be added and removed */
+        x->x_dispatch = 1;
+        argc--;
+        argv++;
+    }
 /* first verify that all arguments are symbols whose first character is '/' */
     for (i = 0; i < argc; ++i)
     {
@@ -199,22 +314,37 @@ static void *routeOSC_new(t_symbol *s, int argc, t_atom *argv)
         }
     }
 /* now allocate the storage for each path */
-    x->x_prefixes = (const char **)getzbytes(x->x_num*sizeof(const char *)); /* the OSC addresses to be matched */
-    x->x_prefix_depth = (int *)getzbytes(x->x_num*sizeof(int));  /* the number of slashes in each prefix */
-    x->x_outlets = (void **)getzbytes((x->x_num+1)*sizeof(void *)); /* one for each prefix plus one for everything else */
+    x->x_size = (x->x_num)?x->x_num:1;
+    x->x_prefixes = (t_symbol **)getzbytes(x->x_size*sizeof(t_symbol *)); /* the OSC addresses to be matched */
+    x->x_prefix_depth = (int *)getzbytes(x->x_size*sizeof(int));  /* the number of slashes in each prefix */
+    x->x_noutlets = (x->x_dispatch)?2:x->x_num+1;
+    x->x_outlets = (void **)getzbytes(x->x_noutlets*sizeof(void *)); /* one for each prefix plus one for everything else */
+    x->x_index = (t_routeOSC_prefix *)getzbytes(x->x_size*sizeof(t_routeOSC_prefix));
+    for (x->x_nbuckets = 1; x->x_nbuckets < 2*x->x_num; x->x_nbuckets *= 2);
+    x->x_buckets = (int *)getzbytes(x->x_nbuckets*sizeof(int));
+    x->x_generic = (int *)getzbytes(x->x_size*sizeof(int));
+    x->x_depth_size = 8;
+    x->x_depth_count = (int *)getzbytes(x->x_depth_size*sizeof(int));
+    x->x_compiled = (t_routeOSC_compiled *)getzbytes(ROUTEOSC_COMPILED_SIZE*sizeof(t_routeOSC_compiled));
+    x->x_memo = (t_routeOSC_memo *)getzbytes(ROUTEOSC_MEMO_SIZE*sizeof(t_routeOSC_memo));
 /* put the pointer to the path in x_prefixes */
 /* put the number of levels in x_prefix_depth */
     for (i = 0; i < x->x_num; ++i)
     {
-        x->x_prefixes[i] = argv[i].a_w.w_symbol->s_name;
-        x->x_prefix_depth[i] = routeOSC_count_slashes(x->x_prefixes[i]);
+        x->x_prefixes[i] = argv[i].a_w.w_symbol;
+        x->x_prefix_depth[i] = routeOSC_count_slashes(x->x_prefixes[i]->s_name);
     }
+    x->x_nroutes = x->x_num;
+    x->x_free = -1;
+    routeOSC_index(x);
     /* Have to create the outlets in reverse order */
     /* well, not in pd ? */
-    for (i = 0; i <= x->x_num; i++)
+    for (i = 0; i < x->x_noutlets; i++)
     {
         x->x_outlets[i] = outlet_new(&x->x_obj, &s_list);
     }
+    x->x_reject = x->x_outlets[x->x_noutlets-1];
+    x->x_canvas = canvas_getcurrent();
     x->x_verbosity = 0; /* quiet by default */
     return (x);
 }
@@ -224,7 +354,7 @@ static void routeOSC_set(t_routeOSC *x, t_symbol *s, int argc, t_atom *argv)
     int i;
     (void)s;
 
-    if (argc > x->x_num)
+    if (argc > x->x_num && !x->x_dispatch)
     {
         pd_error (x, "routeOSC: too many paths");
         return;
@@ -242,21 +372,195 @@ static void routeOSC_set(t_routeOSC *x, t_symbol *s, int argc, t_atom *argv)
             return;
         }
     }
+    if (x->x_dispatch)
+    { /* with -dispatch set replaces all the paths */
+        routeOSC_clear(x);
+        routeOSC_add(x, s, argc, argv);
+        return;
+    }
     for (i = 0; i < argc; ++i)
     {
         if (argv[i].a_w.w_symbol->s_name[0] == '/')
         { /* Now that's a nice prefix */
-            x->x_prefixes[i] = argv[i].a_w.w_symbol->s_name;
-            x->x_prefix_depth[i] = routeOSC_count_slashes(x->x_prefixes[i]);
+            x->x_prefixes[i] = argv[i].a_w.w_symbol;
+            x->x_prefix_depth[i] = routeOSC_count_slashes(x->x_prefixes[i]->s_name);
+        }
+    }
+    routeOSC_index(x);
+}
+
+static void routeOSC_add(t_routeOSC *x, t_symbol *s, int argc, t_atom *argv)
+{ /* with -dispatch, add paths to be matched */
+    int i;
+    (void)s;
+
+    if (!x->x_dispatch)
+    {
+        pd_error(x, "routeOSC: add needs the -dispatch flag");
+        return;
+    }
+    for (i = 0; i < argc; ++i)
+    {
+        if (argv[i].a_type != A_SYMBOL || argv[i].a_w.w_symbol->s_name[0] != '/')
+            pd_error(x, "routeOSC: path %d doesn't start with /", i);
+        else if (!routeOSC_add_path(x, argv[i].a_w.w_symbol))
+        {
+            pd_error(x, "routeOSC: unable to allocate memory for %s", argv[i].a_w.w_symbol->s_name);
+            return;
+        }
+    }
+}
+
+static void routeOSC_remove(t_routeOSC *x, t_symbol *s, int argc, t_atom *argv)
+{ /* with -dispatch, stop matching paths */
+    int i, j;
+    (void)s;
+
+    if (!x->x_dispatch)
+    {
+        pd_error(x, "routeOSC: remove needs the -dispatch flag");
+        return;
+    }
+    for (i = 0; i < argc; ++i)
+    {
+        if (argv[i].a_type != A_SYMBOL || (j = routeOSC_find(x, argv[i].a_w.w_symbol)) < 0)
+        {
+            pd_error(x, "routeOSC: remove: path %d isn't routed", i);
+            continue;
+        }
+        routeOSC_index_remove(x, j);
+        x->x_prefixes[j] = NULL;
+        x->x_index[j].p_next = x->x_free;
+        x->x_free = j;
+        x->x_nroutes--;
+    }
+}
+
+static void routeOSC_load(t_routeOSC *x, t_symbol *filename)
+{ /* with -dispatch, replace the paths with the ones in a file */
+    t_binbuf    *b;
+    t_atom      *v;
+    int         i, n;
+
+    if (!x->x_dispatch)
+    {
+        pd_error(x, "routeOSC: load needs the -dispatch flag");
+        return;
+    }
+    b = binbuf_new();
+    if (binbuf_read_via_canvas(b, filename->s_name, x->x_canvas, 0))
+    {
+        pd_error(x, "routeOSC: %s: can't read file", filename->s_name);
+        binbuf_free(b);
+        return;
+    }
+    routeOSC_clear(x);
+    n = binbuf_getnatom(b);
+    v = binbuf_getvec(b);
+    for (i = 0; i < n; ++i)
+    { /* any symbol that starts with / is a path, the rest is ignored */
+        if (v[i].a_type != A_SYMBOL || v[i].a_w.w_symbol->s_name[0] != '/') continue;
+        if (!routeOSC_add_path(x, v[i].a_w.w_symbol))
+        {
+            pd_error(x, "routeOSC: unable to allocate memory for %s", v[i].a_w.w_symbol->s_name);
+            break;
+        }
+    }
+    binbuf_free(b);
+}
+
+static int routeOSC_add_path(t_routeOSC *x, t_symbol *path)
+{ /* add path to the table and the index, return 0 if there was no room */
+    int i;
+
+    if (routeOSC_find(x, path) >= 0) return 1; /* already there */
+    if (x->x_free >= 0)
+    {
+        i = x->x_free;
+        x->x_free = x->x_index[i].p_next;
+    }
+    else
+    {
+        if (x->x_num == x->x_size && !routeOSC_grow(x)) return 0;
+        i = x->x_num++;
+    }
+    x->x_prefixes[i] = path;
+    x->x_prefix_depth[i] = routeOSC_count_slashes(path->s_name);
+    x->x_nroutes++;
+    if (x->x_nbuckets < 2*x->x_nroutes)
+    { /* keep the buckets at most half full */
+        int *buckets = (int *)getbytes(2*x->x_nbuckets*sizeof(int));
+
+        if (buckets != NULL)
+        {
+            freebytes(x->x_buckets, x->x_nbuckets*sizeof(int));
+            x->x_buckets = buckets;
+            x->x_nbuckets *= 2;
+            routeOSC_index(x);
+            return 1;
         }
     }
+    routeOSC_index_add(x, i);
+    return 1;
+}
+
+static int routeOSC_find(t_routeOSC *x, t_symbol *path)
+{ /* return the slot holding path, or -1 */
+    int i, k;
+
+    for (i = x->x_buckets[routeOSC_hash(path->s_name+1) & (x->x_nbuckets-1)]; i >= 0; i = x->x_index[i].p_next)
+        if (x->x_prefixes[i] == path) return i;
+    for (k = 0; k < x->x_ngeneric; ++k)
+        if (x->x_prefixes[x->x_generic[k]] == path) return x->x_generic[k];
+    return -1;
+}
+
+static int routeOSC_grow(t_routeOSC *x)
+{ /* double the room for prefixes, return 0 if there's no memory */
+    int                 size = 2*x->x_size;
+    t_symbol            **prefixes = (t_symbol **)getzbytes(size*sizeof(t_symbol *));
+    int                 *depths = (int *)getzbytes(size*sizeof(int));
+    t_routeOSC_prefix   *index = (t_routeOSC_prefix *)getzbytes(size*sizeof(t_routeOSC_prefix));
+    int                 *generic = (int *)getzbytes(size*sizeof(int));
+
+    if (prefixes == NULL || depths == NULL || index == NULL || generic == NULL)
+    {
+        if (prefixes != NULL) freebytes(prefixes, size*sizeof(t_symbol *));
+        if (depths != NULL) freebytes(depths, size*sizeof(int));
+        if (index != NULL) freebytes(index, size*sizeof(t_routeOSC_prefix));
+        if (generic != NULL) freebytes(generic, size*sizeof(int));
+        return 0;
+    }
+    memcpy(prefixes, x->x_prefixes, x->x_size*sizeof(t_symbol *));
+    memcpy(depths, x->x_prefix_depth, x->x_size*sizeof(int));
+    memcpy(index, x->x_index, x->x_size*sizeof(t_routeOSC_prefix));
+    memcpy(generic, x->x_generic, x->x_size*sizeof(int));
+    freebytes(x->x_prefixes, x->x_size*sizeof(t_symbol *));
+    freebytes(x->x_prefix_depth, x->x_size*sizeof(int));
+    freebytes(x->x_index, x->x_size*sizeof(t_routeOSC_prefix));
+    freebytes(x->x_generic, x->x_size*sizeof(int));
+    x->x_prefixes = prefixes;
+    x->x_prefix_depth = depths;
+    x->x_index = index;
+    x->x_generic = generic;
+    x->x_size = size;
+    return 1;
+}
+
+static void routeOSC_clear(t_routeOSC *x)
+{ /* remove all the prefixes */
+    x->x_num = 0;
+    x->x_nroutes = 0;
+    x->x_free = -1;
+    routeOSC_index(x);
 }
 
 static void routeOSC_paths(t_routeOSC *x)
 { /* print  out the paths we are matching */
     int i;
 
-    for (i = 0; i < x->x_num; ++i) post("path[%d]: %s (depth %d)", i, x->x_prefixes[i], x->x_prefix_depth[i]);
+    for (i = 0; i < x->x_num; ++i)
+        if (x->x_prefixes[i]) post("path[%d]: %s (depth %d)", i, x->x_prefixes[i]->s_name, x->x_prefix_depth[i]);
 }
 
 static void routeOSC_verbosity(t_routeOSC *x, t_floatarg v)
@@ -265,6 +569,11 @@ static void routeOSC_verbosity(t_routeOSC *x, t_floatarg v)
     if (x->x_verbosity) post("routeOSC_verbosity(%p) is %d", x, x->x_verbosity);
 }
 
+static void routeOSC_stats(t_routeOSC *x)
+{
+    post("routeOSC: match cache: %lu hits, %lu misses", x->x_memo_hits, x->x_memo_misses);
+}
+
 static int routeOSC_count_slashes(const char *prefix)
 { /* find the path depth of the prefix by counting the numberof slashes */
     int i = 0;
@@ -274,11 +583,202 @@ static int routeOSC_count_slashes(const char *prefix)
     return i;
 }
 
+static void routeOSC_index(t_routeOSC *x)
+{ /* rebuild the hash table of prefixes */
+    int i;
+
+    x->x_ngeneric = 0;
+    x->x_max_depth = 0;
+    memset(x->x_depth_count, 0, x->x_depth_size*sizeof(int));
+    for (i = 0; i < x->x_nbuckets; ++i) x->x_buckets[i] = -1;
+    routeOSC_forget(x);
+    for (i = 0; i < x->x_num; ++i)
+        if (x->x_prefixes[i] != NULL) routeOSC_index_add(x, i);
+}
+
+static void routeOSC_index_add(t_routeOSC *x, int i)
+{ /* put prefix i into the hash table, or x_generic */
+    const char          *prefix = x->x_prefixes[i]->s_name;
+    t_routeOSC_prefix   *p = &x->x_index[i];
+    int                 depth = x->x_prefix_depth[i], k, *link;
+
+    routeOSC_forget(x);
+    p->p_generic = (prefix[1] == '*' && prefix[2] == '\0'); /* a single star matches anything, see MyPatternMatch */
+    if (!p->p_generic && depth >= x->x_depth_size)
+    {
+        int *depth_count = (int *)resizebytes(x->x_depth_count, x->x_depth_size*sizeof(int), 2*depth*sizeof(int));
+
+        if (depth_count == NULL) p->p_generic = 1; /* the pattern matcher can still find it */
+        else
+        {
+            memset(depth_count+x->x_depth_size, 0, (2*depth-x->x_depth_size)*sizeof(int));
+            x->x_depth_count = depth_count;
+            x->x_depth_size = 2*depth;
+        }
+    }
+    if (p->p_generic)
+    {
+        for (k = x->x_ngeneric; k > 0 && x->x_generic[k-1] > i; --k) x->x_generic[k] = x->x_generic[k-1];
+        x->x_generic[k] = i;
+        x->x_ngeneric++;
+        return;
+    }
+    p->p_hash = routeOSC_hash(prefix+1);
+    p->p_length = strlen(prefix+1);
+    /* keep each bucket in prefix order */
+    for (link = &x->x_buckets[p->p_hash & (x->x_nbuckets-1)]; *link >= 0 && *link < i; link = &x->x_index[*link].p_next);
+    p->p_next = *link;
+    *link = i;
+    x->x_depth_count[depth]++;
+    if (depth > x->x_max_depth) x->x_max_depth = depth;
+}
+
+static void routeOSC_index_remove(t_routeOSC *x, int i)
+{ /* take prefix i out of the hash table, or x_generic */
+    t_routeOSC_prefix   *p = &x->x_index[i];
+    int                 k, *link;
+
+    routeOSC_forget(x);
+    if (p->p_generic)
+    {
+        for (k = 0; x->x_generic[k] != i; ++k);
+        for (x->x_ngeneric--; k < x->x_ngeneric; ++k) x->x_generic[k] = x->x_generic[k+1];
+        return;
+    }
+    for (link = &x->x_buckets[p->p_hash & (x->x_nbuckets-1)]; *link != i; link = &x->x_index[*link].p_next);
+    *link = p->p_next;
+    x->x_depth_count[x->x_prefix_depth[i]]--;
+    while (x->x_max_depth > 0 && x->x_depth_count[x->x_max_depth] == 0) x->x_max_depth--;
+}
+
+static void routeOSC_forget(t_routeOSC *x)
+{ /* the remembered matches are wrong once the prefixes change */
+    int i;
+
+    for (i = 0; i < ROUTEOSC_MEMO_SIZE; ++i) x->x_memo[i].m_symbol = NULL;
+}
+
+static unsigned int routeOSC_hash(const char *s)
+{
+    const unsigned char *p = (const unsigned char *)s;
+    unsigned int        h = ROUTEOSC_HASH_BASIS;
+
+    for (; *p != '\0'; ++p) h = (h ^ *p) * ROUTEOSC_HASH_PRIME;
+    return h;
+}
+
+static int routeOSC_has_wildcards(const char *pattern)
+{
+    for (; *pattern != '\0'; ++pattern)
+        if (strchr("*?[]{}\\", *pattern)) return 1;
+    return 0;
+}
+
+static int routeOSC_match(t_routeOSC *x, t_symbol *s, int pattern_depth, int *matches)
+{ /* put the indices of the prefixes that s matches into matches, in order, and return how many */
+    const char  *pattern = s->s_name;
+    int         i, j, k, n = 0, ngeneric = x->x_num;
+    const int   *generic = NULL;
+
+    if (!routeOSC_has_wildcards(pattern))
+    { /* look up the address up to each slash, as deep as the deepest prefix */
+        const unsigned char *p = (const unsigned char *)pattern+1;
+        unsigned int        h = ROUTEOSC_HASH_BASIS;
+        int                 depth = 1;
+
+        for (;; ++p)
+        {
+            if (*p == '/' || *p == '\0')
+            {
+                if (depth <= x->x_max_depth && x->x_depth_count[depth])
+                {
+                    int length = (int)(p - (const unsigned char *)pattern) - 1;
+
+                    for (i = x->x_buckets[h & (x->x_nbuckets-1)]; i >= 0; i = x->x_index[i].p_next)
+                        if (x->x_index[i].p_hash == h && x->x_index[i].p_length == length
+                            && x->x_prefix_depth[i] == depth && !memcmp(x->x_prefixes[i]->s_name+1, pattern+1, length))
+                            matches[n++] = i;
+                }
+                if (*p == '\0' || depth >= x->x_max_depth) break;
+                ++depth;
+            }
+            h = (h ^ *p) * ROUTEOSC_HASH_PRIME;
+        }
+        generic = x->x_generic;
+        ngeneric = x->x_ngeneric;
+    }
+    for (k = 0; k < ngeneric; ++k)
+    {
+        t_routeOSC_compiled *c;
+
+        i = (generic)?generic[k]:k;
+        if (x->x_prefixes[i] == NULL || x->x_prefix_depth[i] > pattern_depth) continue;
+        if ((c = routeOSC_compile(x, s, x->x_prefix_depth[i])) == NULL) continue;
+        if (x->x_verbosity)
+            post("routeOSC_doanything _6_(%p): (%d) patternBegin is %s", x, i, c->c_string);
+        if (MyPatternMatch(x, c, x->x_prefixes[i]->s_name+1)) matches[n++] = i;
+    }
+    /* the prefixes from different depths and x_generic need merging */
+    for (k = 1; k < n; ++k)
+    {
+        i = matches[k];
+        for (j = k; j > 0 && matches[j-1] > i; --j) matches[j] = matches[j-1];
+        matches[j] = i;
+    }
+    return n;
+}
+
+static int routeOSC_lookup(t_routeOSC *x, t_symbol *s, int pattern_depth, int *matches, t_symbol **rest)
+{ /* like routeOSC_match, but also give the rest of the address for each match, from x_memo if possible */
+    t_routeOSC_memo *m = &x->x_memo[((size_t)s >> 4) & (ROUTEOSC_MEMO_SIZE-1)];
+    int             k, n;
+
+    if (m->m_symbol == s)
+    {
+        x->x_memo_hits++;
+        memcpy(matches, m->m_matches, m->m_nmatches*sizeof(int));
+        memcpy(rest, m->m_rest, m->m_nmatches*sizeof(t_symbol *));
+        return m->m_nmatches;
+    }
+    x->x_memo_misses++;
+    n = routeOSC_match(x, s, pattern_depth, matches);
+    for (k = 0; k < n; ++k)
+    {
+        const char *nextSlash = NthSlashOrNull(s->s_name+1, x->x_prefix_depth[matches[k]]);
+        rest[k] = (*nextSlash != '\0')?gensym(nextSlash):NULL;
+    }
+    m->m_symbol = NULL;
+    if (m->m_size < n)
+    { /* make room for n matches, or don't remember this address */
+        int         *mm = (int *)getbytes(n*sizeof(int));
+        t_symbol    **mr = (t_symbol **)getbytes(n*sizeof(t_symbol *));
+
+        if (mm == NULL || mr == NULL)
+        {
+            if (mm != NULL) freebytes(mm, n*sizeof(int));
+            if (mr != NULL) freebytes(mr, n*sizeof(t_symbol *));
+            return n;
+        }
+        if (m->m_matches) freebytes(m->m_matches, m->m_size*sizeof(int));
+        if (m->m_rest) freebytes(m->m_rest, m->m_size*sizeof(t_symbol *));
+        m->m_matches = mm;
+        m->m_rest = mr;
+        m->m_size = n;
+    }
+    memcpy(m->m_matches, matches, n*sizeof(int));
+    memcpy(m->m_rest, rest, n*sizeof(t_symbol *));
+    m->m_nmatches = n;
+    m->m_symbol = s;
+    return n;
+}
+
 static void routeOSC_doanything(t_routeOSC *x, t_symbol *s, int argc, t_atom *argv)
 {
     const char    *pattern, *nextSlash;
-    int     i = 0, pattern_depth = 0, matchedAnything = 0;
+    int     i = 0, k, pattern_depth = 0, matchedAnything = 0;
     int     noPath = 0; // nonzero if we are dealing with a simple list (as from a previous [routeOSC])
+    int     stack_matches[ROUTEOSC_STACK_MATCHES], *matches = stack_matches, size = x->x_num;
+    t_symbol *stack_rest[ROUTEOSC_STACK_MATCHES], **rest = stack_rest;
 
     pattern = s->s_name;
     if (x->x_verbosity) post("routeOSC_doanything(%p): pattern is %s", x, pattern);
@@ -286,66 +786,75 @@ static void routeOSC_doanything(t_routeOSC *x, t_symbol *s, int argc, t_atom *ar
     {
         /* output unmatched data on rightmost outlet */
         if (x->x_verbosity) post("routeOSC_doanything no OSC path(%p) , %d args", x, argc);
-        outlet_anything(x->x_outlets[x->x_num], s, argc, argv);
+        outlet_anything(x->x_reject, s, argc, argv);
         return;
     }
     pattern_depth = routeOSC_count_slashes(pattern);
     if (x->x_verbosity) post("routeOSC_doanything(%p): pattern_depth is %i", x, pattern_depth);
+    /* find all the matches before outputting anything, the outlets may send us another message */
+    if (size > ROUTEOSC_STACK_MATCHES)
+    {
+        matches = (int *)getbytes(size*sizeof(int));
+        rest = (t_symbol **)getbytes(size*sizeof(t_symbol *));
+        if (matches == NULL || rest == NULL)
+        {
+            if (matches != NULL) freebytes(matches, size*sizeof(int));
+            if (rest != NULL) freebytes(rest, size*sizeof(t_symbol *));
+            pd_error(x, "routeOSC: unable to allocate room for %d matches of %s", size, s->s_name);
+            return;
+        }
+    }
+    matchedAnything = routeOSC_lookup(x, s, pattern_depth, matches, rest);
     nextSlash = NextSlashOrNull(pattern+1);
     if (*nextSlash == '\0')
     { /* pattern_depth == 1 */
         /* last level of the address, so we'll output the argument list */
 
-        for (i = 0; i < x->x_num; ++i)
+        for (k = 0; k < matchedAnything; ++k)
         {
-            if
-            (
-                (x->x_prefix_depth[i] <= pattern_depth)
-                && (MyPatternMatch(x, pattern+1, x->x_prefixes[i]+1))
-            )
+            i = matches[k];
+            if (x->x_dispatch)
+                routeOSC_dispatch(x, i, rest[k], argc, argv);
+            else if (noPath)
+            { // just a list starting with a symbol
+              // The special symbol is s
+              if (x->x_verbosity) post("routeOSC_doanything _1_(%p): (%d) noPath: s is \"%s\"", x, i, s->s_name);
+              outlet_anything(x->x_outlets[i], s, argc, argv);
+            }
+            else // normal OSC path
             {
-                ++matchedAnything;
-                if (noPath)
-                { // just a list starting with a symbol
-                  // The special symbol is s
-                  if (x->x_verbosity) post("routeOSC_doanything _1_(%p): (%d) noPath: s is \"%s\"", x, i, s->s_name);
-                  outlet_anything(x->x_outlets[i], s, argc, argv);
+                // I hate stupid Max lists with a special first element
+                if (argc == 0)
+                {
+                    if (x->x_verbosity) post("routeOSC_doanything _2_(%p): (%d) no args", x, i);
+                    outlet_bang(x->x_outlets[i]);
                 }
-                else // normal OSC path
+                else if (argv[0].a_type == A_SYMBOL)
                 {
-                    // I hate stupid Max lists with a special first element
-                    if (argc == 0)
-                    {
-                        if (x->x_verbosity) post("routeOSC_doanything _2_(%p): (%d) no args", x, i);
-                        outlet_bang(x->x_outlets[i]);
-                    }
-                    else if (argv[0].a_type == A_SYMBOL)
-                    {
-                        // Promote the symbol that was argv[0] to the special symbol
-                        if (x->x_verbosity) post("routeOSC_doanything _3_(%p): (%d) symbol: is \"%s\"", x, i, argv[0].a_w.w_symbol->s_name);
-                        outlet_anything(x->x_outlets[i], argv[0].a_w.w_symbol, argc-1, argv+1);
-                    }
-                    else if (argc > 1)
+                    // Promote the symbol that was argv[0] to the special symbol
+                    if (x->x_verbosity) post("routeOSC_doanything _3_(%p): (%d) symbol: is \"%s\"", x, i, argv[0].a_w.w_symbol->s_name);
+                    outlet_anything(x->x_outlets[i], argv[0].a_w.w_symbol, argc-1, argv+1);
+                }
+                else if (argc > 1)
+                {
+                    // Multiple arguments starting with a number, so naturally we have
+                    // to use a special function to output this "list", since it's what
+                    // Max originally meant by "list".
+                    if (x->x_verbosity) post("routeOSC_doanything _4_(%p): (%d) list:", x, i);
+                    outlet_list(x->x_outlets[i], 0L, argc, argv);
+                }
+                else
+                {
+                    // There was only one argument, and it was a number, so we output it
+                    // not as a list
+                    if (argv[0].a_type == A_FLOAT)
                     {
-                        // Multiple arguments starting with a number, so naturally we have
-                        // to use a special function to output this "list", since it's what
-                        // Max originally meant by "list".
-                        if (x->x_verbosity) post("routeOSC_doanything _4_(%p): (%d) list:", x, i);
-                        outlet_list(x->x_outlets[i], 0L, argc, argv);
+                        if (x->x_verbosity) post("routeOSC_doanything _5_(%p): (%d) a single float", x, i);
+                        outlet_float(x->x_outlets[i], argv[0].a_w.w_float);
                     }
                     else
                     {
-                        // There was only one argument, and it was a number, so we output it
-                        // not as a list
-                        if (argv[0].a_type == A_FLOAT)
-                        {
-                            if (x->x_verbosity) post("routeOSC_doanything _5_(%p): (%d) a single float", x, i);
-                            outlet_float(x->x_outlets[i], argv[0].a_w.w_float);
-                        }
-                        else
-                        {
-                            pd_error(x, "* routeOSC: unrecognized atom type!");
-                        }
+                        pd_error(x, "* routeOSC: unrecognized atom type!");
                     }
                 }
             }
@@ -355,78 +864,85 @@ static void routeOSC_doanything(t_routeOSC *x, t_symbol *s, int argc, t_atom *ar
     {
         /* There's more address after this part, so our output list will begin with
            the next slash.  */
-        t_symbol *restOfPattern = 0; /* avoid the gensym unless we have to output */
-        char patternBegin[1000];
-
-        /* Get the incoming pattern to match against all our prefixes */
-
-        for (i = 0; i < x->x_num; ++i)
+        for (k = 0; k < matchedAnything; ++k)
         {
-            restOfPattern = 0;
-            if (x->x_prefix_depth[i] <= pattern_depth)
+            i = matches[k];
+            if (x->x_dispatch)
             {
-                StrCopyUntilNthSlash(patternBegin, pattern+1, x->x_prefix_depth[i]);
-                if (x->x_verbosity)
-                    post("routeOSC_doanything _6_(%p): (%d) patternBegin is %s", x, i, patternBegin);
-                if (MyPatternMatch(x, patternBegin, x->x_prefixes[i]+1))
-                {
-                    if (x->x_verbosity)
-                        post("routeOSC_doanything _7_(%p): (%d) matched %s depth %d", x, i, x->x_prefixes[i], x->x_prefix_depth[i]);
-                    ++matchedAnything;
-                    nextSlash = NthSlashOrNull(pattern+1, x->x_prefix_depth[i]);
-                    if (x->x_verbosity)
-                        post("routeOSC_doanything _8_(%p): (%d) nextSlash %s [%d]", x, i, nextSlash, nextSlash[0]);
-                    if (*nextSlash != '\0')
-                    {
-                        if (x->x_verbosity) post("routeOSC_doanything _9_(%p): (%d) more pattern", x, i);
-                        restOfPattern = gensym(nextSlash);
-                        outlet_anything(x->x_outlets[i], restOfPattern, argc, argv);
-                    }
-                    else if (argc == 0)
-                    {
-                        if (x->x_verbosity) post("routeOSC_doanything _10_(%p): (%d) no more pattern, no args", x, i);
-                        outlet_bang(x->x_outlets[i]);
-                    }
-                    else
-                    {
-                        if (x->x_verbosity) post("routeOSC_doanything _11_(%p): (%d) no more pattern, %d args", x, i, argc);
-                        if (argv[0].a_type == A_SYMBOL) // Promote the symbol that was argv[0] to the special symbol
-                            outlet_anything(x->x_outlets[i], argv[0].a_w.w_symbol, argc-1, argv+1);
-                        else
-                            outlet_anything(x->x_outlets[i], gensym("list"), argc, argv);
-                    }
-                }
+                routeOSC_dispatch(x, i, rest[k], argc, argv);
+                continue;
+            }
+            if (x->x_verbosity)
+                post("routeOSC_doanything _7_(%p): (%d) matched %s depth %d", x, i, x->x_prefixes[i]->s_name, x->x_prefix_depth[i]);
+            if (x->x_verbosity)
+                post("routeOSC_doanything _8_(%p): (%d) rest of pattern %s", x, i, (rest[k])?rest[k]->s_name:"");
+            if (rest[k] != NULL)
+            {
+                if (x->x_verbosity) post("routeOSC_doanything _9_(%p): (%d) more pattern", x, i);
+                outlet_anything(x->x_outlets[i], rest[k], argc, argv);
+            }
+            else if (argc == 0)
+            {
+                if (x->x_verbosity) post("routeOSC_doanything _10_(%p): (%d) no more pattern, no args", x, i);
+                outlet_bang(x->x_outlets[i]);
+            }
+            else
+            {
+                if (x->x_verbosity) post("routeOSC_doanything _11_(%p): (%d) no more pattern, %d args", x, i, argc);
+                if (argv[0].a_type == A_SYMBOL) // Promote the symbol that was argv[0] to the special symbol
+                    outlet_anything(x->x_outlets[i], argv[0].a_w.w_symbol, argc-1, argv+1);
+                else
+                    outlet_anything(x->x_outlets[i], gensym("list"), argc, argv);
             }
         }
     }
+    if (matches != stack_matches)
+    {
+        freebytes(matches, size*sizeof(int));
+        freebytes(rest, size*sizeof(t_symbol *));
+    }
     if (!matchedAnything)
     {
         // output unmatched data on rightmost outlet a la normal 'route' object, jdl 20020908
         if (x->x_verbosity) post("routeOSC_doanything _13_(%p) unmatched %d, %d args", x, i, argc);
-        outlet_anything(x->x_outlets[x->x_num], s, argc, argv);
+        outlet_anything(x->x_reject, s, argc, argv);
     }
 }
 
+static void routeOSC_dispatch(t_routeOSC *x, int i, t_symbol *rest, int argc, t_atom *argv)
+{ /* with -dispatch, output a match as a message to its prefix, with the rest of the address if any before the arguments */
+    t_atom  stack_atoms[ROUTEOSC_STACK_ATOMS], *atoms = stack_atoms;
+    int     n = argc + 1 + (rest != NULL);
+
+    if (i >= x->x_num || x->x_prefixes[i] == NULL) return; /* removed by an earlier output */
+    if (n > ROUTEOSC_STACK_ATOMS && (atoms = (t_atom *)getbytes(n*sizeof(t_atom))) == NULL) return;
+    SETSYMBOL(&atoms[0], x->x_prefixes[i]);
+    if (rest != NULL) SETSYMBOL(&atoms[1], rest);
+    memcpy(&atoms[n-argc], argv, argc*sizeof(t_atom));
+    outlet_anything(x->x_outlets[0], x->x_prefixes[i], n-1, atoms+1);
+    if (atoms != stack_atoms) freebytes(atoms, n*sizeof(t_atom));
+}
+
 static void routeOSC_bang(t_routeOSC *x)
 {
     /* output non-OSC data on rightmost outlet */
     if (x->x_verbosity) post("routeOSC_bang (%p)", x);
 
-    outlet_bang(x->x_outlets[x->x_num]);
+    outlet_bang(x->x_reject);
 }
 static void routeOSC_float(t_routeOSC *x, t_floatarg f)
 {
     /* output non-OSC data on rightmost outlet */
     if (x->x_verbosity) post("routeOSC_float (%p) %f", x, f);
 
-    outlet_float(x->x_outlets[x->x_num], f);
+    outlet_float(x->x_reject, f);
 }
 static void routeOSC_symbol(t_routeOSC *x, t_symbol *s)
 {
     /* output non-OSC data on rightmost outlet */
     if (x->x_verbosity) post("routeOSC_symbol (%p) %s", x, s->s_name);
 
-    outlet_symbol(x->x_outlets[x->x_num], s);
+    outlet_symbol(x->x_reject, s);
 }
 
 static void routeOSC_list(t_routeOSC *x, t_symbol *s, int argc, t_atom *argv)
@@ -441,7 +957,7 @@ static void routeOSC_list(t_routeOSC *x, t_symbol *s, int argc, t_atom *argv)
     else if (argv[0].a_type == A_FLOAT)
     {
         if (x->x_verbosity) post("routeOSC_list (%p) floats:", x);
-        outlet_list(x->x_outlets[x->x_num], 0L, argc, argv);
+        outlet_list(x->x_reject, 0L, argc, argv);
     }
 }
 
@@ -477,167 +993,174 @@ static void StrCopyUntilSlash(char *target, const char *source)
     *target = 0;
 }
 
-static void StrCopyUntilNthSlash(char *target, const char *source, int n)
-{ /* copy the path up but not including the nth slash */
-    int i = n;
-
-    while (i > 0)
-    {
-        while (*source != '/')
-        {
-            *target = *source;
-            if (*source == '\0') return;
-            ++target;
-            ++source;
-        }
-        i--;
-        /* got  a slash. If it's the nth, don't include it */
-        if (i == 0)
-        {
-            *target = 0;
-            return;
-        }
-        *target = *source;
-        ++source;
-        ++target;
-    }
-}
-
 /* from
     OSC-pattern-match.c
     Matt Wright, 3/16/98
     Adapted from oscpattern.c, by Matt Wright and Amar Chaudhury
-*/
-
-static int PatternMatch (void *x, const char *pattern, const char *test)
-{
-    theWholePattern = pattern;
-
-    if (pattern == 0 || pattern[0] == 0) return test[0] == 0;
-
-    if (test[0] == 0)
-    {
-        if (pattern[0] == '*') return PatternMatch (x, pattern+1, test);
-        return 0;
-    }
-
-    switch (pattern[0])
-    {
-        case 0:
-            return test[0] == 0;
-        case '?':
-            return PatternMatch (x, pattern+1, test+1);
-        case '*':
-            if (PatternMatch (x, pattern+1, test)) return 1;
-            return PatternMatch (x, pattern, test+1);
-        case ']':
-        case '}':
-                  pd_error(x, "routeOSC: Spurious %c in pattern \".../%s/...\"",pattern[0], theWholePattern);
-            return 0;
-        case '[':
-            return MatchBrackets (x, pattern,test);
-        case '{':
-            return MatchList (x, pattern,test);
-        case '\\':
-            if (pattern[1] == 0) return test[0] == 0;
-            if (pattern[1] == test[0]) return PatternMatch (x, pattern+2,test+1);
-            return 0;
-        default:
-            if (pattern[0] == test[0]) return PatternMatch (x, pattern+1,test+1);
-            return 0;
-    }
-}
-
-/* we know that pattern[0] == '[' and test[0] != 0 */
-
-static int MatchBrackets (void *x, const char *pattern, const char *test)
-{
-    int result;
-    int negated = 0;
-    const char *p = pattern;
-
-    if (pattern[1] == 0)
+   The recursive matcher backtracked and so could take exponential time on
+   patterns like *a*b*c*d. Now the pattern is compiled to a list of tokens once
+   and run against each prefix with all the possible token positions tracked
+   together, one character at a time. It matches what the recursive one did. */
+
+static t_routeOSC_compiled *routeOSC_compile(t_routeOSC *x, t_symbol *s, int depth)
+{ /* return the first depth levels of address pattern s compiled, from the cache if possible */
+    t_routeOSC_compiled *c = &x->x_compiled[(((size_t)s >> 4) ^ (size_t)depth*31) & (ROUTEOSC_COMPILED_SIZE-1)];
+    const char          *pattern = s->s_name+1, *end = NthSlashOrNull(pattern, depth), *p;
+    size_t              length = end - pattern;
+    t_routeOSC_token    *t;
+
+    if (c->c_symbol == s && c->c_depth == depth) return c;
+    c->c_symbol = NULL;
+    if (c->c_stringsize < length+1)
     {
-        pd_error(x, "routeOSC: Unterminated [ in pattern \".../%s/...\"", theWholePattern);
-        return 0;
+        char *string = (char *)resizebytes(c->c_string, c->c_stringsize, length+1);
+        if (string == NULL) return NULL;
+        c->c_string = string;
+        c->c_stringsize = length+1;
     }
-    if (pattern[1] == '!')
+    if (c->c_tokensize < (length+1)*sizeof(t_routeOSC_token))
     {
-        negated = 1;
-        p++;
+        t_routeOSC_token *tokens = (t_routeOSC_token *)resizebytes(c->c_tokens, c->c_tokensize,
+            (length+1)*sizeof(t_routeOSC_token));
+        if (tokens == NULL) return NULL;
+        c->c_tokens = tokens;
+        c->c_tokensize = (length+1)*sizeof(t_routeOSC_token);
     }
-    while (*p != ']')
+    memcpy(c->c_string, pattern, length);
+    c->c_string[length] = '\0';
+    c->c_valid = 1;
+    c->c_ntokens = 0;
+    for (p = c->c_string; *p != '\0' && c->c_valid; ++p)
     {
-        if (*p == 0)
-        {
-            pd_error(x, "Unterminated [ in pattern \".../%s/...\"", theWholePattern);
-            return 0;
-        }
-        if (p[1] == '-' && p[2] != 0)
+        t = &c->c_tokens[c->c_ntokens++];
+        switch (*p)
         {
-            if (test[0] >= p[0] && test[0] <= p[2])
-            {
-                result = !negated;
-                goto advance;
+            case '?':
+                t->t_type = ROUTEOSC_ANY;
+                break;
+            case '*':
+                t->t_type = ROUTEOSC_STAR;
+                break;
+            case ']':
+            case '}':
+                pd_error(x, "routeOSC: Spurious %c in pattern \"%s\"", *p, c->c_string);
+                c->c_valid = 0;
+                break;
+            case '[':
+            { /* the first character after [ (or [!) is a member even if it's ], as is a following - */
+                const char  *first = (p[1] == '!')?p+1:p, *close, *q;
+                int         ch;
+
+                for (close = first; *close != ']' && *close != '\0'; ++close);
+                if (p[1] == '\0' || *close == '\0')
+                {
+                    pd_error(x, "routeOSC: Unterminated [ in pattern \"%s\"", c->c_string);
+                    c->c_valid = 0;
+                    break;
+                }
+                t->t_type = ROUTEOSC_SET;
+                memset(t->t_set, 0, sizeof(t->t_set));
+                for (ch = 1; ch < 256; ++ch)
+                {
+                    char    test = (char)ch;
+                    int     member = 0;
+
+                    for (q = first; q < close && !member; ++q)
+                        member = (q[1] == '-' && q[2] != '\0' && test >= q[0] && test <= q[2]) || q[0] == test;
+                    if (member != (first != p)) t->t_set[ch >> 5] |= 1u << (ch & 31);
+                }
+                p = close;
+                break;
             }
+            case '{':
+            { /* the characters in the list are all literal */
+                const char *close = strchr(p, '}');
+
+                if (close == NULL)
+                {
+                    pd_error(x, "routeOSC: Unterminated { in pattern \"%s\"", c->c_string);
+                    c->c_valid = 0;
+                    break;
+                }
+                t->t_type = ROUTEOSC_LIST;
+                t->t_list = p+1;
+                t->t_listlength = close-p-1;
+                p = close;
+                break;
+            }
+            case '\\':
+                if (p[1] == '\0')
+                { /* a backslash at the end never matches */
+                    c->c_valid = 0;
+                    break;
+                }
+                ++p;
+                /* fall through */
+            default:
+                t->t_type = ROUTEOSC_CHAR;
+                t->t_char = *p;
+                break;
         }
-        if (p[0] == test[0])
-        {
-            result = !negated;
-            goto advance;
-        }
-        p++;
-    }
-    result = negated;
-advance:
-    if (!result) return 0;
-    while (*p != ']')
-    {
-        if (*p == 0)
-        {
-            pd_error(x, "Unterminated [ in pattern \".../%s/...\"", theWholePattern);
-            return 0;
-        }
-        p++;
     }
-    return PatternMatch (x, p+1,test+1);
+    c->c_symbol = s;
+    c->c_depth = depth;
+    return c;
 }
 
-static int MatchList (void *x, const char *pattern, const char *test)
-{
-    const char *restOfPattern, *tp = test;
-
-    for(restOfPattern = pattern; *restOfPattern != '}'; restOfPattern++)
-    {
-        if (*restOfPattern == 0)
-        {
-            pd_error(x, "Unterminated { in pattern \".../%s/...\"", theWholePattern);
-            return 0;
-        }
-    }
-    restOfPattern++; /* skip close curly brace */
-    pattern++; /* skip open curly brace */
-    while (1)
+static int PatternMatch (const t_routeOSC_compiled *pattern, const char *test)
+{ /* run pattern on test, tracking the set of tokens reached at each character of test */
+    int             length = strlen(test), words = pattern->c_ntokens/32+1, i, j, result;
+    size_t          size = (size_t)(length+1)*words;
+    unsigned int    stack_states[ROUTEOSC_STACK_STATES], *states = stack_states;
+
+    if (!pattern->c_valid) return 0;
+    if (size > ROUTEOSC_STACK_STATES && (states = (unsigned int *)getbytes(size*sizeof(unsigned int))) == NULL) return 0;
+    memset(states, 0, size*sizeof(unsigned int));
+#define ROUTEOSC_REACHED(i, j) (states[(i)*words + ((j) >> 5)] & (1u << ((j) & 31)))
+#define ROUTEOSC_REACH(i, j) (states[(i)*words + ((j) >> 5)] |= 1u << ((j) & 31))
+    ROUTEOSC_REACH(0, 0);
+    for (i = 0; i <= length; ++i)
     {
-        if (*pattern == ',')
-        {
-            if (PatternMatch (x, restOfPattern, tp)) return 1;
-            tp = test;
-            ++pattern;
-        }
-        else if (*pattern == '}') return PatternMatch (x, restOfPattern, tp);
-        else if (*pattern == *tp)
-        {
-            ++pattern;
-            ++tp;
-        }
-        else
+        unsigned char ch = test[i];
+
+        /* tokens that match nothing reach the next token at this character, so go upwards */
+        for (j = 0; j < pattern->c_ntokens; ++j)
         {
-            tp = test;
-            while (*pattern != ',' && *pattern != '}') pattern++;
-            if (*pattern == ',') pattern++;
+            const t_routeOSC_token *t = &pattern->c_tokens[j];
+
+            if (!ROUTEOSC_REACHED(i, j)) continue;
+            if (t->t_type == ROUTEOSC_STAR)
+            {
+                ROUTEOSC_REACH(i, j+1);
+                if (ch) ROUTEOSC_REACH(i+1, j);
+            }
+            else if (ch == 0) continue; /* only a * can match at the end */
+            else if (t->t_type == ROUTEOSC_ANY
+                || (t->t_type == ROUTEOSC_CHAR && (char)ch == t->t_char)
+                || (t->t_type == ROUTEOSC_SET && (t->t_set[ch >> 5] & (1u << (ch & 31)))))
+                ROUTEOSC_REACH(i+1, j+1);
+            else if (t->t_type == ROUTEOSC_LIST)
+            { /* as before, if the last alternative doesn't match the list matches nothing */
+                const char *alternative = t->t_list, *listend = t->t_list + t->t_listlength, *comma;
+
+                for (;; alternative = comma+1)
+                {
+                    int n;
+
+                    for (comma = alternative; comma < listend && *comma != ','; ++comma);
+                    n = comma - alternative;
+                    if (n <= length-i && !memcmp(alternative, test+i, n)) ROUTEOSC_REACH(i+n, j+1);
+                    else if (comma == listend) ROUTEOSC_REACH(i, j+1);
+                    if (comma == listend) break;
+                }
+            }
         }
     }
+    result = ROUTEOSC_REACHED(length, pattern->c_ntokens) != 0;
+#undef ROUTEOSC_REACHED
+#undef ROUTEOSC_REACH
+    if (states != stack_states) freebytes(states, size*sizeof(unsigned int));
+    return result;
 }
 
 /* end of routeOSC.c */
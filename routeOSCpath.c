@@ -0,0 +1,287 @@
+/* routeOSCpath.c routes whole OSC addresses in one step, instead of a chain of [routeOSC]s */
+/* An argument like /mixer/ch/#/gain is a template: each # matches a segment made of digits, */
+/* and the numbers are output before the message arguments. */
+#include "m_pd.h"
+
+#include <string.h>
+
+#define ROUTEOSCPATH_STACK_ATOMS 64 // atoms of an output built without allocating
+#define ROUTEOSCPATH_MAX_DIGITS 9 // longest number a # will match, so it is exact as a float
+
+/* the templates are kept as a tree of address segments */
+typedef struct _routeOSCpath_node
+{
+    const char  *n_segment; /* points into the template symbol, not terminated */
+    int         n_length; /* of n_segment */
+    int         n_child; /* first child with a literal segment, or -1 */
+    int         n_next; /* next sibling with a literal segment, or -1 */
+    int         n_capture; /* the child for a #, or -1 */
+    int         n_route; /* the template that ends here, or -1 */
+} t_routeOSCpath_node;
+
+typedef struct _routeOSCpath
+{
+    t_object            x_obj;
+    int                 x_num; /* number of templates */
+    t_symbol            **x_templates; /* the addresses to be matched */
+    int                 *x_ncaptures; /* the number of # in each template */
+    int                 x_maxdepth; /* the most segments in any template */
+    t_routeOSCpath_node *x_nodes; /* x_nodes[0] is the root */
+    int                 x_nnodes;
+    int                 x_nodesize;
+    void                **x_outlets; /* one for each template plus one for everything else */
+    void                *x_reject;
+} t_routeOSCpath;
+
+static t_class *routeOSCpath_class;
+
+void routeOSCpath_setup(void);
+static void *routeOSCpath_new(t_symbol *s, int argc, t_atom *argv);
+static void routeOSCpath_free(t_routeOSCpath *x);
+static void routeOSCpath_anything(t_routeOSCpath *x, t_symbol *s, int argc, t_atom *argv);
+static void routeOSCpath_list(t_routeOSCpath *x, t_symbol *s, int argc, t_atom *argv);
+static void routeOSCpath_bang(t_routeOSCpath *x);
+static void routeOSCpath_float(t_routeOSCpath *x, t_floatarg f);
+static void routeOSCpath_symbol(t_routeOSCpath *x, t_symbol *s);
+static void routeOSCpath_set(t_routeOSCpath *x, t_symbol *s, int argc, t_atom *argv);
+static void routeOSCpath_paths(t_routeOSCpath *x);
+static int routeOSCpath_build(t_routeOSCpath *x);
+static int routeOSCpath_insert(t_routeOSCpath *x, int i);
+static int routeOSCpath_node(t_routeOSCpath *x, const char *segment, int length);
+static int routeOSCpath_walk(t_routeOSCpath *x, int node, const char *p, t_atom *captures, int ncaptures);
+
+static void *routeOSCpath_new(t_symbol *s, int argc, t_atom *argv)
+{
+    t_routeOSCpath  *x = (t_routeOSCpath *)pd_new(routeOSCpath_class);
+    int             i;
+
+    for (i = 0; i < argc; ++i)
+    {
+        if (argv[i].a_type != A_SYMBOL || argv[i].a_w.w_symbol->s_name[0] != '/')
+        {
+            pd_error(x, "* %s: argument %d is not a path starting with /", s->s_name, i);
+            return 0;
+        }
+    }
+    x->x_num = argc;
+    x->x_templates = (t_symbol **)getzbytes((argc+1)*sizeof(t_symbol *));
+    x->x_ncaptures = (int *)getzbytes((argc+1)*sizeof(int));
+    x->x_outlets = (void **)getzbytes((argc+1)*sizeof(void *));
+    x->x_nodesize = 16;
+    x->x_nodes = (t_routeOSCpath_node *)getbytes(x->x_nodesize*sizeof(t_routeOSCpath_node));
+    for (i = 0; i < argc; ++i) x->x_templates[i] = argv[i].a_w.w_symbol;
+    if (!routeOSCpath_build(x)) pd_error(x, "* %s: unable to allocate memory", s->s_name);
+    for (i = 0; i <= argc; ++i) x->x_outlets[i] = outlet_new(&x->x_obj, &s_list);
+    x->x_reject = x->x_outlets[argc];
+    return (x);
+}
+
+static void routeOSCpath_free(t_routeOSCpath *x)
+{
+    freebytes(x->x_templates, (x->x_num+1)*sizeof(t_symbol *));
+    freebytes(x->x_ncaptures, (x->x_num+1)*sizeof(int));
+    freebytes(x->x_outlets, (x->x_num+1)*sizeof(void *));
+    freebytes(x->x_nodes, x->x_nodesize*sizeof(t_routeOSCpath_node));
+}
+
+static void routeOSCpath_anything(t_routeOSCpath *x, t_symbol *s, int argc, t_atom *argv)
+{
+    t_atom  stack_atoms[ROUTEOSCPATH_STACK_ATOMS], *atoms = stack_atoms;
+    int     route, n, size = x->x_maxdepth + argc;
+
+    if (s->s_name[0] != '/')
+    {
+        outlet_anything(x->x_reject, s, argc, argv);
+        return;
+    }
+    /* the numbers go straight into the output, ahead of the arguments */
+    if (size > ROUTEOSCPATH_STACK_ATOMS && (atoms = (t_atom *)getbytes(size*sizeof(t_atom))) == NULL)
+    {
+        pd_error(x, "routeOSCpath: unable to allocate memory for %d atoms", size);
+        return;
+    }
+    if ((route = routeOSCpath_walk(x, 0, s->s_name, atoms, 0)) < 0)
+        outlet_anything(x->x_reject, s, argc, argv);
+    else
+    {
+        n = x->x_ncaptures[route];
+        if (argc) memcpy(&atoms[n], argv, argc*sizeof(t_atom));
+        n += argc;
+        if (n == 0) outlet_bang(x->x_outlets[route]);
+        else if (atoms[0].a_type == A_SYMBOL) outlet_anything(x->x_outlets[route], atoms[0].a_w.w_symbol, n-1, atoms+1);
+        else outlet_list(x->x_outlets[route], &s_list, n, atoms);
+    }
+    if (atoms != stack_atoms) freebytes(atoms, size*sizeof(t_atom));
+}
+
+static void routeOSCpath_list(t_routeOSCpath *x, t_symbol *s, int argc, t_atom *argv)
+{ /* a list starting with a path is treated like a message to that path */
+    (void)s;
+    if (argc && argv[0].a_type == A_SYMBOL) routeOSCpath_anything(x, argv[0].a_w.w_symbol, argc-1, argv+1);
+    else outlet_list(x->x_reject, &s_list, argc, argv);
+}
+
+static void routeOSCpath_bang(t_routeOSCpath *x)
+{ /* output non-OSC data on rightmost outlet */
+    outlet_bang(x->x_reject);
+}
+
+static void routeOSCpath_float(t_routeOSCpath *x, t_floatarg f)
+{
+    outlet_float(x->x_reject, f);
+}
+
+static void routeOSCpath_symbol(t_routeOSCpath *x, t_symbol *s)
+{
+    outlet_symbol(x->x_reject, s);
+}
+
+static void routeOSCpath_set(t_routeOSCpath *x, t_symbol *s, int argc, t_atom *argv)
+{ /* replace the templates, as many as there are outlets for */
+    int i;
+    (void)s;
+
+    if (argc > x->x_num)
+    {
+        pd_error(x, "routeOSCpath: too many paths");
+        return;
+    }
+    for (i = 0; i < argc; ++i)
+    {
+        if (argv[i].a_type != A_SYMBOL || argv[i].a_w.w_symbol->s_name[0] != '/')
+        {
+            pd_error(x, "routeOSCpath: path %d doesn't start with /", i);
+            return;
+        }
+    }
+    for (i = 0; i < argc; ++i) x->x_templates[i] = argv[i].a_w.w_symbol;
+    if (!routeOSCpath_build(x)) pd_error(x, "routeOSCpath: unable to allocate memory");
+}
+
+static void routeOSCpath_paths(t_routeOSCpath *x)
+{ /* print out the templates we are matching */
+    int i;
+
+    for (i = 0; i < x->x_num; ++i)
+        post("path[%d]: %s (captures %d)", i, x->x_templates[i]->s_name, x->x_ncaptures[i]);
+}
+
+static int routeOSCpath_build(t_routeOSCpath *x)
+{ /* rebuild the tree from the templates, return 0 if there was no memory */
+    int i;
+
+    x->x_nnodes = 0;
+    x->x_maxdepth = 0;
+    routeOSCpath_node(x, "", 0); /* the root, x_nodesize is never 0 */
+    for (i = 0; i < x->x_num; ++i)
+        if (!routeOSCpath_insert(x, i)) return 0;
+    return 1;
+}
+
+static int routeOSCpath_insert(t_routeOSCpath *x, int i)
+{ /* add template i to the tree, return 0 if there was no memory */
+    const char  *p = x->x_templates[i]->s_name, *end;
+    int         node = 0, child, depth = 0, length;
+
+    x->x_ncaptures[i] = 0;
+    while (*p == '/')
+    {
+        for (end = p+1; *end != '/' && *end != '\0'; ++end);
+        length = end - (p+1);
+        if (length == 1 && p[1] == '#')
+        {
+            if (x->x_nodes[node].n_capture < 0)
+            {
+                if ((child = routeOSCpath_node(x, p+1, length)) < 0) return 0;
+                x->x_nodes[node].n_capture = child;
+            }
+            node = x->x_nodes[node].n_capture;
+            x->x_ncaptures[i]++;
+        }
+        else
+        {
+            int *link;
+
+            for (link = &x->x_nodes[node].n_child; *link >= 0; link = &x->x_nodes[*link].n_next)
+                if (x->x_nodes[*link].n_length == length && !memcmp(x->x_nodes[*link].n_segment, p+1, length)) break;
+            if (*link < 0)
+            { /* link may move when the nodes grow */
+                if ((child = routeOSCpath_node(x, p+1, length)) < 0) return 0;
+                for (link = &x->x_nodes[node].n_child; *link >= 0; link = &x->x_nodes[*link].n_next);
+                *link = child;
+            }
+            node = *link;
+        }
+        p = end;
+        depth++;
+    }
+    if (depth > x->x_maxdepth) x->x_maxdepth = depth;
+    if (x->x_nodes[node].n_route >= 0)
+        pd_error(x, "routeOSCpath: %s is already routed to outlet %d", x->x_templates[i]->s_name, x->x_nodes[node].n_route);
+    else x->x_nodes[node].n_route = i;
+    return 1;
+}
+
+static int routeOSCpath_node(t_routeOSCpath *x, const char *segment, int length)
+{ /* return a new node for segment, or -1 if there was no memory */
+    t_routeOSCpath_node *n;
+
+    if (x->x_nnodes == x->x_nodesize)
+    {
+        n = (t_routeOSCpath_node *)resizebytes(x->x_nodes, x->x_nodesize*sizeof(t_routeOSCpath_node),
+            2*x->x_nodesize*sizeof(t_routeOSCpath_node));
+        if (n == NULL) return -1;
+        x->x_nodes = n;
+        x->x_nodesize *= 2;
+    }
+    n = &x->x_nodes[x->x_nnodes];
+    n->n_segment = segment;
+    n->n_length = length;
+    n->n_child = n->n_next = n->n_capture = n->n_route = -1;
+    return x->x_nnodes++;
+}
+
+static int routeOSCpath_walk(t_routeOSCpath *x, int node, const char *p, t_atom *captures, int ncaptures)
+{ /* match the rest of the address p from node, return the template or -1 */
+  /* A literal segment is tried before #, so /a/1/b can have its own outlet next to /a/#/b */
+    const char  *segment = p+1, *end;
+    int         child, route, length;
+
+    if (*p == '\0') return x->x_nodes[node].n_route;
+    for (end = segment; *end != '/' && *end != '\0'; ++end);
+    length = end - segment;
+    for (child = x->x_nodes[node].n_child; child >= 0; child = x->x_nodes[child].n_next)
+    {
+        if (x->x_nodes[child].n_length == length && !memcmp(x->x_nodes[child].n_segment, segment, length)
+            && (route = routeOSCpath_walk(x, child, end, captures, ncaptures)) >= 0)
+            return route;
+    }
+    if ((child = x->x_nodes[node].n_capture) >= 0 && length > 0 && length <= ROUTEOSCPATH_MAX_DIGITS)
+    {
+        const char  *q;
+        long        value = 0;
+
+        for (q = segment; q < end && *q >= '0' && *q <= '9'; ++q) value = 10*value + (*q - '0');
+        if (q == end)
+        {
+            SETFLOAT(&captures[ncaptures], (t_float)value);
+            return routeOSCpath_walk(x, child, end, captures, ncaptures+1);
+        }
+    }
+    return -1;
+}
+
+void routeOSCpath_setup(void)
+{
+    routeOSCpath_class = class_new(gensym("routeOSCpath"), (t_newmethod)routeOSCpath_new,
+        (t_method)routeOSCpath_free, sizeof(t_routeOSCpath), 0, A_GIMME, 0);
+    class_addanything(routeOSCpath_class, routeOSCpath_anything);
+    class_addlist(routeOSCpath_class, routeOSCpath_list);
+    class_addbang(routeOSCpath_class, routeOSCpath_bang);
+    class_addfloat(routeOSCpath_class, routeOSCpath_float);
+    class_addsymbol(routeOSCpath_class, routeOSCpath_symbol);
+    class_addmethod(routeOSCpath_class, (t_method)routeOSCpath_set, gensym("set"), A_GIMME, 0);
+    class_addmethod(routeOSCpath_class, (t_method)routeOSCpath_paths, gensym("paths"), 0);
+}
+
+/* end of routeOSCpath.c */
@@ -68,28 +68,138 @@ The OSC webpage is http://opensoundcontrol.org
 #include "packingOSC.h"
 #include "OSC_timeTag.h"
 
+#define UNPACKOSC_SYMCACHE_SIZE 256 /* number of slots in the symbol cache, must be a power of 2 */
+#define UNPACKOSC_SYMCACHE_KEY 64 /* longest padded string the symbol cache holds, in bytes */
+
+/* what schedule mode does with a bundle whose time has passed */
+#define UNPACKOSC_LATE_NOW 0 /* output it at once */
+#define UNPACKOSC_LATE_DROP 1 /* drop it */
+#define UNPACKOSC_LATE_CLAMP 2 /* queue it for now, after anything else that is due */
+
+#define UNPACKOSC_REDRAW_MS 50 /* at most one array redraw per this many milliseconds */
+
 static t_class *unpackOSC_class;
 
+typedef struct _unpackOSC_symcached
+{
+    uint32_t    c_key[UNPACKOSC_SYMCACHE_KEY/4]; /* the padded string */
+    size_t      c_length; /* its padded length, 0 if the slot is empty */
+    t_symbol    *c_symbol;
+} t_unpackOSC_symcached;
+
+typedef struct _unpackOSC_scratch
+{
+    t_atom      *s_atoms; /* the arguments of the message being decoded */
+    size_t      s_size; /* number of atoms allocated */
+} t_unpackOSC_scratch;
+
+typedef struct _unpackOSC_pattern
+{
+    char        *p_bytes; /* the address, padded with nulls */
+    size_t      p_length; /* its length without the padding */
+    size_t      p_size; /* its padded length */
+    int         p_wild; /* non-zero if it has OSC wildcards: ? * [] {} */
+    t_outlet    *p_out;
+} t_unpackOSC_pattern;
+
+typedef struct _unpackOSC_arraymap
+{
+    t_symbol    *m_path; /* the OSC address, which may have wildcards */
+    int         m_wild; /* non-zero if it has OSC wildcards */
+    t_symbol    *m_array; /* the name of the array its arguments are written into */
+    int         m_dirty; /* non-zero if the array needs redrawing */
+} t_unpackOSC_arraymap;
+
+typedef struct _unpackOSC_event
+{
+    double          e_time; /* the logical time the message is due */
+    unsigned long   e_seq; /* order of arrival, for messages due at the same time */
+    t_outlet        *e_out; /* NULL to send to the receiver e_path */
+    t_symbol        *e_path;
+    int             e_argc;
+    t_atom          *e_argv;
+} t_unpackOSC_event;
+
 typedef struct _unpackOSC
 {
     t_object    x_obj;
-    t_outlet    *x_data_out;
+    t_outlet    *x_data_out; /* messages that match no address pattern */
     t_outlet    *x_delay_out;
-    int         x_bundle_flag;/* non-zero if we are processing a bundle */
-    int         x_recursion_level;/* number of times we reenter unpackOSC_list */
-    int         x_abort_bundle;/* non-zero if unpackOSC_list is not well formed */
-    int         x_reentry_count;
+    int         x_reentry_count;/* non-zero while we are decoding, so x_raw and x_scratch are in use */
+    char        *x_raw; /* the packet as bytes, grown to the largest packet seen */
+    size_t      x_rawsize;
+    t_unpackOSC_scratch x_scratch; /* grown to the largest message seen */
 
     int         x_use_pd_time;
     OSCTimeTag  x_pd_timetag;
     double      x_pd_timeref;
+
+    t_unpackOSC_symcached *x_symcache; /* [UNPACKOSC_SYMCACHE_SIZE] direct-mapped symbol cache */
+    unsigned long x_symcache_hits;
+    unsigned long x_symcache_misses;
+
+    int         x_schedule; /* non-zero to hold bundle contents until their time tag */
+    int         x_late; /* UNPACKOSC_LATE_NOW, _DROP or _CLAMP */
+    t_clock     *x_clock; /* fires when the first message in x_queue is due */
+    t_unpackOSC_event *x_queue; /* binary heap of scheduled messages, earliest first */
+    int         x_queuelength;
+    int         x_queuesize;
+    unsigned long x_seq;
+    unsigned long x_early; /* bundles that arrived before their time tag */
+    unsigned long x_ontime; /* bundles that were due immediately */
+    unsigned long x_late_count; /* bundles that arrived after their time tag */
+    unsigned long x_dropped; /* messages dropped because they were late */
+
+    t_unpackOSC_pattern *x_patterns; /* addresses from the creation arguments, one outlet each */
+    int         x_npatterns;
+    unsigned long x_matched; /* messages that matched a pattern */
+    unsigned long x_rejected; /* messages that didn't */
+
+    int         x_strict; /* non-zero to check the whole packet before outputting any of it */
+    int         x_markers; /* non-zero to output bundle_begin and bundle_end around each bundle */
+    unsigned long x_malformed; /* packets dropped by strict mode */
+
+    t_unpackOSC_arraymap *x_arrays; /* addresses whose arguments go into arrays */
+    int         x_narrays;
+    int         x_arraysize; /* the number of mappings x_arrays has room for */
+    t_clock     *x_redrawclock; /* redraws the arrays that have been written */
+    int         x_redrawpending;
+
+    int         x_dispatch; /* non-zero to send messages to receivers named by their address */
+    t_symbol    *x_dispatchprefix; /* put in front of the address to name the receiver, or NULL */
+    unsigned long x_dispatched; /* messages sent to receivers */
 } t_unpackOSC;
 
 void unpackOSC_setup(void);
-static void *unpackOSC_new(void);
+static void *unpackOSC_new(t_symbol *s, int argc, t_atom *argv);
 static void unpackOSC_free(t_unpackOSC *x);
 static void unpackOSC_list(t_unpackOSC *x, t_symbol *s, int argc, t_atom *argv);
 static void unpackOSC_usepdtime(t_unpackOSC *x, t_floatarg f);
+static void unpackOSC_stats(t_unpackOSC *x);
+static void unpackOSC_setschedule(t_unpackOSC *x, t_floatarg f);
+static void unpackOSC_setlate(t_unpackOSC *x, t_symbol *s);
+static void unpackOSC_setstrict(t_unpackOSC *x, t_floatarg f);
+static void unpackOSC_setmarkers(t_unpackOSC *x, t_floatarg f);
+static void unpackOSC_marker(t_unpackOSC *x, t_symbol *s, int depth, double delay);
+static void unpackOSC_array(t_unpackOSC *x, t_symbol *s, int argc, t_atom *argv);
+static t_unpackOSC_arraymap *unpackOSC_findarray(t_unpackOSC *x, t_symbol *path, int wild);
+static int unpackOSC_toarray(t_unpackOSC *x, t_unpackOSC_arraymap *m, const char *args, int n);
+static void unpackOSC_redraw(t_unpackOSC *x);
+static void unpackOSC_setdispatch(t_unpackOSC *x, t_symbol *s, int argc, t_atom *argv);
+static const char *unpackOSC_validate(const char *buf, int n, int depth, const char **where);
+static const char *unpackOSC_stringend(const char *string, const char *end);
+static t_symbol *unpackOSC_receiver(t_unpackOSC *x, t_symbol *path);
+static void unpackOSC_output(t_unpackOSC *x, t_outlet *out, t_symbol *path, int argc, t_atom *argv, int withdelay);
+static void unpackOSC_schedule(t_unpackOSC *x, t_outlet *out, t_symbol *path, int argc, t_atom *argv, double delay);
+static void unpackOSC_deliver(t_unpackOSC *x, t_outlet *out, t_symbol *path, int argc, t_atom *argv, int depth, double delay);
+static void unpackOSC_decode(t_unpackOSC *x, const char *buf, int length, t_unpackOSC_scratch *scratch);
+static void unpackOSC_message(t_unpackOSC *x, const char *buf, int n, t_unpackOSC_scratch *scratch, int depth, double delay);
+static double unpackOSC_timetagdelay(t_unpackOSC *x, const char *timetag);
+static int unpackOSC_matches(const t_unpackOSC_pattern *p, const char *address, size_t length);
+static int unpackOSC_wildmatch(const char *pattern, const char *address, const char *end, int whole);
+static void unpackOSC_tick(t_unpackOSC *x);
+static void unpackOSC_flush(t_unpackOSC *x, int output);
+static t_symbol *unpackOSC_gensym(t_unpackOSC *x, const char *string, size_t length);
 static t_symbol* unpackOSC_path(t_unpackOSC *x, const char *path, size_t length);
 static void unpackOSC_Smessage(t_unpackOSC *x, t_atom *data_at, int *data_atc, void *v, int n);
 static void unpackOSC_PrintTypeTaggedArgs(t_unpackOSC *x, t_atom *data_at, int *data_atc, void *v, int n);
@@ -97,15 +207,51 @@ static void unpackOSC_PrintHeuristicallyTypeGuessedArgs(t_unpackOSC *x, t_atom *
 static const char *unpackOSC_DataAfterAlignedString(t_unpackOSC *x, const char *string, const char *boundary);
 static int unpackOSC_IsNiceString(t_unpackOSC *x, const char *string, const char *boundary);
 
-static void *unpackOSC_new(void)
+static void *unpackOSC_new(t_symbol *s, int argc, t_atom *argv)
 {
     t_unpackOSC *x;
+    int         i;
+
+    (void)s;
     x = (t_unpackOSC *)pd_new(unpackOSC_class);
+    /* Each creation argument is an OSC address, which may have wildcards, with
+       its own outlet for messages to that address or below it. Messages that
+       match none of them go out the next outlet, and aren't decoded at all if
+       nothing is connected to it (and no receiver takes them, see dispatch). */
+    for (i = 0; i < argc; ++i)
+    {
+        if (argv[i].a_type == A_SYMBOL && argv[i].a_w.w_symbol->s_name[0] == '/') x->x_npatterns++;
+        else pd_error(x, "unpackOSC: arguments must be OSC addresses beginning with /");
+    }
+    if (x->x_npatterns)
+    {
+        t_unpackOSC_pattern *p = (t_unpackOSC_pattern *)getzbytes(sizeof(t_unpackOSC_pattern)*x->x_npatterns);
+
+        x->x_patterns = p;
+        for (i = 0; i < argc; ++i)
+        {
+            const char *address;
+
+            if (argv[i].a_type != A_SYMBOL || argv[i].a_w.w_symbol->s_name[0] != '/') continue;
+            address = argv[i].a_w.w_symbol->s_name;
+            p->p_length = strlen(address);
+            while (p->p_length && address[p->p_length-1] == '/') p->p_length--;
+            p->p_size = (p->p_length+4) & ~3;
+            p->p_bytes = (char *)getzbytes(p->p_size);
+            memcpy(p->p_bytes, address, p->p_length);
+            p->p_wild = (strcspn(p->p_bytes, "?*[{") < p->p_length);
+            p->p_out = outlet_new(&x->x_obj, &s_list);
+            p++;
+        }
+    }
     x->x_data_out = outlet_new(&x->x_obj, &s_list);
     x->x_delay_out = outlet_new(&x->x_obj, &s_float);
-    x->x_bundle_flag = 0;
-    x->x_recursion_level = 0;
-    x->x_abort_bundle = 0;
+    x->x_symcache = (t_unpackOSC_symcached *)getzbytes(sizeof(t_unpackOSC_symcached)*UNPACKOSC_SYMCACHE_SIZE);
+    if (x->x_symcache == NULL) /* we can still use gensym */
+        pd_error(x, "unpackOSC: unable to allocate %lu bytes for x_symcache",
+            (long)(sizeof(t_unpackOSC_symcached)*UNPACKOSC_SYMCACHE_SIZE));
+    x->x_clock = clock_new(x, (t_method)unpackOSC_tick);
+    x->x_redrawclock = clock_new(x, (t_method)unpackOSC_redraw);
 
     unpackOSC_usepdtime(x, 1.);
     return (x);
@@ -113,17 +259,45 @@ static void *unpackOSC_new(void)
 
 static void unpackOSC_free(t_unpackOSC *x)
 {
-    (void)x;
+    unpackOSC_flush(x, 0);
+    clock_free(x->x_clock);
+    clock_free(x->x_redrawclock);
+    if (x->x_arrays != NULL) freebytes(x->x_arrays, sizeof(t_unpackOSC_arraymap)*x->x_arraysize);
+    if (x->x_queue != NULL) freebytes(x->x_queue, sizeof(t_unpackOSC_event)*x->x_queuesize);
+    if (x->x_raw != NULL) freebytes(x->x_raw, x->x_rawsize);
+    if (x->x_scratch.s_atoms != NULL) freebytes(x->x_scratch.s_atoms, sizeof(t_atom)*x->x_scratch.s_size);
+    if (x->x_symcache != NULL)
+        freebytes(x->x_symcache, sizeof(t_unpackOSC_symcached)*UNPACKOSC_SYMCACHE_SIZE);
+    if (x->x_patterns != NULL)
+    {
+        int i;
+        for (i = 0; i < x->x_npatterns; ++i) freebytes(x->x_patterns[i].p_bytes, x->x_patterns[i].p_size);
+        freebytes(x->x_patterns, sizeof(t_unpackOSC_pattern)*x->x_npatterns);
+    }
 }
 
 void unpackOSC_setup(void)
 {
     unpackOSC_class = class_new(gensym("unpackOSC"),
         (t_newmethod)unpackOSC_new, (t_method)unpackOSC_free,
-        sizeof(t_unpackOSC), 0, 0);
+        sizeof(t_unpackOSC), 0, A_GIMME, 0);
     class_addlist(unpackOSC_class, (t_method)unpackOSC_list);
     class_addmethod(unpackOSC_class, (t_method)unpackOSC_usepdtime,
         gensym("usepdtime"), A_FLOAT, 0);
+    class_addmethod(unpackOSC_class, (t_method)unpackOSC_stats,
+        gensym("stats"), 0);
+    class_addmethod(unpackOSC_class, (t_method)unpackOSC_setschedule,
+        gensym("schedule"), A_FLOAT, 0);
+    class_addmethod(unpackOSC_class, (t_method)unpackOSC_setlate,
+        gensym("late"), A_SYMBOL, 0);
+    class_addmethod(unpackOSC_class, (t_method)unpackOSC_setstrict,
+        gensym("strict"), A_FLOAT, 0);
+    class_addmethod(unpackOSC_class, (t_method)unpackOSC_setmarkers,
+        gensym("markers"), A_FLOAT, 0);
+    class_addmethod(unpackOSC_class, (t_method)unpackOSC_array,
+        gensym("array"), A_GIMME, 0);
+    class_addmethod(unpackOSC_class, (t_method)unpackOSC_setdispatch,
+        gensym("dispatch"), A_GIMME, 0);
 }
 static void unpackOSC_usepdtime(t_unpackOSC *x, t_floatarg f)
 {
@@ -138,139 +312,711 @@ static void unpackOSC_usepdtime(t_unpackOSC *x, t_floatarg f)
 
 }
 
-/* unpackOSC_list expects an OSC packet in the form of a list of floats on [0..255] */
-static void unpackOSC_dolist(t_unpackOSC *x, int argc, const char *buf, t_atom out_argv[MAX_MESG])
+static void unpackOSC_stats(t_unpackOSC *x)
 {
-    debugprint(">>> %s(%p, %d, %p)\n", __FUNCTION__, x, argc, buf);
-    debugprint(">>> unpackOSC_list: %d bytes, abort=%d, reentry_count %d recursion_level %d\n",
-        argc, x->x_abort_bundle, x->x_reentry_count, x->x_recursion_level);
-    if(x->x_abort_bundle) return; /* if backing quietly out of the recursive stack */
-    x->x_reentry_count++;
-    if ((argc%4) != 0)
+    post("unpackOSC: symbol cache: %lu hits, %lu misses", x->x_symcache_hits, x->x_symcache_misses);
+    post("unpackOSC: bundles: %lu early, %lu on time, %lu late", x->x_early, x->x_ontime, x->x_late_count);
+    post("unpackOSC: schedule: %d messages queued, %lu dropped", x->x_queuelength, x->x_dropped);
+    if (x->x_npatterns)
+        post("unpackOSC: patterns: %lu messages matched, %lu rejected", x->x_matched, x->x_rejected);
+    if (x->x_strict)
+        post("unpackOSC: strict: %lu malformed packets dropped", x->x_malformed);
+    if (x->x_dispatch)
+        post("unpackOSC: dispatch: %lu messages sent to receivers", x->x_dispatched);
+}
+
+static void unpackOSC_setstrict(t_unpackOSC *x, t_floatarg f)
+{
+/* With strict on, a packet is only output if all of it is well formed,
+   otherwise the whole packet is dropped before any message goes out. */
+    x->x_strict = (f != 0);
+}
+
+static void unpackOSC_setschedule(t_unpackOSC *x, t_floatarg f)
+{
+/* With schedule on, messages in bundles are held until the time in their time tag
+   and then output with a delay of 0. Turning it off outputs anything still held. */
+    x->x_schedule = (f != 0);
+    if (!x->x_schedule) unpackOSC_flush(x, 1);
+}
+
+static void unpackOSC_setlate(t_unpackOSC *x, t_symbol *s)
+{
+    if (s == gensym("now")) x->x_late = UNPACKOSC_LATE_NOW;
+    else if (s == gensym("drop")) x->x_late = UNPACKOSC_LATE_DROP;
+    else if (s == gensym("clamp")) x->x_late = UNPACKOSC_LATE_CLAMP;
+    else pd_error(x, "unpackOSC: late: %s is not now, drop or clamp", s->s_name);
+}
+
+static void unpackOSC_setmarkers(t_unpackOSC *x, t_floatarg f)
+{
+/* With markers on, each bundle's messages are preceded by bundle_begin <depth> <delay>
+   and followed by bundle_end <depth>, so they can be handled as a batch. */
+    x->x_markers = (f != 0);
+}
+
+static void unpackOSC_marker(t_unpackOSC *x, t_symbol *s, int depth, double delay)
+{
+/* output bundle_begin or bundle_end from each message outlet, right to left */
+    t_atom  a[2];
+    int     i;
+
+    SETFLOAT(&a[0], depth);
+    SETFLOAT(&a[1], delay);
+    unpackOSC_deliver(x, x->x_data_out, s, (s == gensym("bundle_begin"))?2:1, a, depth, delay);
+    for (i = x->x_npatterns-1; i >= 0; --i)
+        unpackOSC_deliver(x, x->x_patterns[i].p_out, s, (s == gensym("bundle_begin"))?2:1, a, depth, delay);
+}
+
+static void unpackOSC_array(t_unpackOSC *x, t_symbol *s, int argc, t_atom *argv)
+{
+/* array <address> <arrayname> writes the blobs and numbers in messages to address
+   straight into the array, and outputs only the address and the number written.
+   The address may be a pattern with OSC wildcards matching whole addresses.
+   array <address> turns that off again. */
+    t_unpackOSC_arraymap    *m, *maps;
+    t_symbol                *path;
+
+    (void)s;
+    if (argc < 1 || argc > 2 || argv[0].a_type != A_SYMBOL || (argc == 2 && argv[1].a_type != A_SYMBOL))
     {
-        pd_error(x, "unpackOSC: Packet size (%d) not a multiple of 4 bytes: dropping packet", argc);
-        goto unpackOSC_list_out;
+        pd_error(x, "unpackOSC: usage: array <address> [<arrayname>]");
+        return;
     }
+    path = argv[0].a_w.w_symbol;
+    m = unpackOSC_findarray(x, path, 0);
+    if (argc == 1)
+    {
+        if (m == NULL) return;
+        *m = x->x_arrays[--x->x_narrays];
+        if (x->x_narrays == 0)
+        {
+            freebytes(x->x_arrays, sizeof(t_unpackOSC_arraymap)*x->x_arraysize);
+            x->x_arrays = NULL;
+            x->x_arraysize = 0;
+        }
+        else if ((maps = (t_unpackOSC_arraymap *)resizebytes(x->x_arrays,
+            sizeof(t_unpackOSC_arraymap)*x->x_arraysize, sizeof(t_unpackOSC_arraymap)*x->x_narrays)) != NULL)
+        {
+            x->x_arrays = maps;
+            x->x_arraysize = x->x_narrays;
+        } /* else keep the old block, shrinking it is optional */
+        return;
+    }
+    if (m == NULL)
+    {
+        if (x->x_narrays == x->x_arraysize)
+        {
+            maps = (t_unpackOSC_arraymap *)resizebytes(x->x_arrays,
+                sizeof(t_unpackOSC_arraymap)*x->x_arraysize, sizeof(t_unpackOSC_arraymap)*(x->x_arraysize+1));
+            if (maps == NULL)
+            {
+                pd_error(x, "unpackOSC: unable to allocate an array mapping for %s", path->s_name);
+                return;
+            }
+            x->x_arrays = maps;
+            x->x_arraysize++;
+        }
+        m = &x->x_arrays[x->x_narrays++];
+        m->m_path = path;
+        m->m_wild = (strcspn(path->s_name, "?*[{") < strlen(path->s_name));
+    }
+    m->m_array = argv[1].a_w.w_symbol;
+    m->m_dirty = 0;
+}
+
+static t_unpackOSC_arraymap *unpackOSC_findarray(t_unpackOSC *x, t_symbol *path, int wild)
+{
+/* Find the mapping for exactly this address, or if wild is set and there is none,
+   the first one whose pattern matches the whole address. */
+    int i;
 
-    if ((argc >= 8) && (strncmp(buf, "#bundle", 8) == 0))
-    { /* This is a bundle message. */
-        int i = 16; /* Skip "#bundle\0" and time tag */
-        OSCTimeTag tt;
-        double delta = 0.;
-        debugprint("unpackOSC: bundle msg:\n");
+    for (i = 0; i < x->x_narrays; ++i)
+        if (x->x_arrays[i].m_path == path) return &x->x_arrays[i];
+    if (wild) for (i = 0; i < x->x_narrays; ++i)
+    {
+        const char *address = x->x_arrays[i].m_path->s_name;
 
-        if (argc < 16)
+        if (x->x_arrays[i].m_wild
+            && unpackOSC_wildmatch(address, path->s_name, path->s_name+strlen(path->s_name), 1))
+            return &x->x_arrays[i];
+    }
+    return NULL;
+}
+
+static int unpackOSC_toarray(t_unpackOSC *x, t_unpackOSC_arraymap *m, const char *args, int n)
+{
+/* Write the arguments of a message into m's array without making atoms of them.
+   Blobs give one element per byte, f i and d one element each. Anything past the
+   end of the array is ignored. Returns the number of elements written, or -1. */
+    const char  *end = args+n, *thisType, *p;
+    t_garray    *a;
+    t_word      *vec;
+    int         size, i = 0;
+
+    if (!(a = (t_garray *)pd_findbyclass(m->m_array, garray_class)))
+    {
+        pd_error(x, "unpackOSC: %s: no such array", m->m_array->s_name);
+        return -1;
+    }
+    if (!garray_getfloatwords(a, &size, &vec))
+    {
+        pd_error(x, "unpackOSC: %s: bad template", m->m_array->s_name);
+        return -1;
+    }
+    if (n < 4 || *args != ',' || !unpackOSC_IsNiceString(x, args, end)
+        || (p = unpackOSC_DataAfterAlignedString(x, args, end)) == NULL)
+    {
+        pd_error(x, "unpackOSC: %s: messages written to an array need type tags", m->m_path->s_name);
+        return -1;
+    }
+    for (thisType = args + 1; *thisType != 0; ++thisType)
+    {
+        if (end-p < ((*thisType == 'd')?8:4))
         {
-            pd_error(x, "unpackOSC: Bundle message too small (%d bytes) for time tag", argc);
-            goto unpackOSC_list_out;
+            pd_error(x, "unpackOSC: %s: no argument for type tag %c", m->m_path->s_name, *thisType);
+            return -1;
         }
+        switch (*thisType)
+        {
+            case 'b':
+            {
+                int j, blob_bytes = ntohl(*((int *) p));
+                p += 4;
+                if (blob_bytes < 0 || blob_bytes > end-p)
+                {
+                    pd_error(x, "unpackOSC: %s: blob of %d bytes is longer than the message", m->m_path->s_name, blob_bytes);
+                    return -1;
+                }
+                for (j = 0; j < blob_bytes && i < size; ++j, ++i)
+                    vec[i].w_float = ((const unsigned char *)p)[j];
+                p += ((blob_bytes+3) & ~3) < end-p?((blob_bytes+3) & ~3):end-p;
+                break;
+            }
+            case 'i':
+                if (i < size) vec[i++].w_float = (signed)ntohl(*((int *) p));
+                p += 4;
+                break;
+            case 'f':
+            {
+                intfloat32 thisif;
+                thisif.i = ntohl(*((int *) p));
+                if (i < size) vec[i++].w_float = thisif.f;
+                p += 4;
+                break;
+            }
+            case 'd':
+            {
+                intfloat64 thisif;
+                thisif.i = ((uint64_t)ntohl(*((uint32_t *) p)) << 32) | ntohl(*((uint32_t *) (p+4)));
+                if (i < size) vec[i++].w_float = (t_float)thisif.d;
+                p += 8;
+                break;
+            }
+            default:
+                pd_error(x, "unpackOSC: %s: type tag %c can't be written to an array", m->m_path->s_name, *thisType);
+                return -1;
+        }
+    }
+    /* redraw at most every UNPACKOSC_REDRAW_MS, however often the array is written */
+    m->m_dirty = 1;
+    if (!x->x_redrawpending)
+    {
+        x->x_redrawpending = 1;
+        clock_delay(x->x_redrawclock, UNPACKOSC_REDRAW_MS);
+    }
+    return i;
+}
+
+static void unpackOSC_redraw(t_unpackOSC *x)
+{
+    t_garray    *a;
+    int         i, j;
+
+    x->x_redrawpending = 0;
+    for (i = 0; i < x->x_narrays; ++i)
+    {
+        if (!x->x_arrays[i].m_dirty) continue;
+        /* several addresses may write the same array */
+        for (j = i; j < x->x_narrays; ++j)
+            if (x->x_arrays[j].m_array == x->x_arrays[i].m_array) x->x_arrays[j].m_dirty = 0;
+        if ((a = (t_garray *)pd_findbyclass(x->x_arrays[i].m_array, garray_class))) garray_redraw(a);
+    }
+}
+
+static void unpackOSC_setdispatch(t_unpackOSC *x, t_symbol *s, int argc, t_atom *argv)
+{
+/* dispatch 1 [prefix] sends each message straight to the receivers named by its
+   address, or by prefix followed by its address. Only messages that nobody
+   receives go out the outlets. */
+    (void)s;
+    if (argc < 1 || argc > 2 || argv[0].a_type != A_FLOAT || (argc == 2 && argv[1].a_type != A_SYMBOL))
+    {
+        pd_error(x, "unpackOSC: usage: dispatch <0|1> [<prefix>]");
+        return;
+    }
+    x->x_dispatch = (argv[0].a_w.w_float != 0);
+    x->x_dispatchprefix = (argc == 2 && *argv[1].a_w.w_symbol->s_name)?argv[1].a_w.w_symbol:NULL;
+}
+
+static t_symbol *unpackOSC_receiver(t_unpackOSC *x, t_symbol *path)
+{
+/* Return the receiver name for path if something is bound to it, else NULL. */
+    t_symbol *receiver = path;
 
-        x->x_bundle_flag = 1;
-
-        /* Print the time tag */
-        debugprint("unpackOSC bundle timetag: [ %x.%0x\n", ntohl(*((uint32_t *)(buf+8))),
-            ntohl(*((uint32_t *)(buf+12))));
-
-        /* convert the timetag into a millisecond delay from now */
-        tt.seconds = ntohl(*((uint32_t *)(buf+8)));
-        tt.fraction = ntohl(*((uint32_t *)(buf+12)));
-        /* pd can use a delay in milliseconds */
-        if (tt.seconds == 0 && tt.fraction ==1) {
-            delta = 0;
-        } else {
-            OSCTimeTag now;
-            if (x->x_use_pd_time) {
-                double deltaref = clock_gettimesince(x->x_pd_timeref);
-                now = OSCTT_offsetms(x->x_pd_timetag, deltaref);
-            } else {
-                now = OSCTT_Now();
+    if (x->x_dispatchprefix != NULL)
+    {
+        char name[MAXPDSTRING];
+        snprintf(name, MAXPDSTRING, "%s%s", x->x_dispatchprefix->s_name, path->s_name);
+        receiver = gensym(name);
+    }
+    return (receiver->s_thing)?receiver:NULL;
+}
+
+static void unpackOSC_output(t_unpackOSC *x, t_outlet *out, t_symbol *path, int argc, t_atom *argv, int withdelay)
+{
+/* Output a message, after a delay of 0 if withdelay is non-zero.
+   A NULL out sends it to path instead, which is then the receiver name
+   from unpackOSC_receiver, if that is still bound. */
+    if (out == NULL)
+    {
+        if (path->s_thing)
+        {
+            x->x_dispatched++;
+            pd_typedmess(path->s_thing, (argc)?&s_list:&s_bang, argc, argv);
+        }
+        return;
+    }
+    if (withdelay) outlet_float(x->x_delay_out, 0);
+    outlet_anything(out, path, argc, argv);
+}
+
+static void unpackOSC_deliver(t_unpackOSC *x, t_outlet *out, t_symbol *path, int argc, t_atom *argv, int depth, double delay)
+{
+/* Output a decoded message now or, when scheduling, when its bundle is due.
+   The delay of a bundle has already been output unless it was scheduled. */
+    if (x->x_schedule && delay != 0)
+        unpackOSC_schedule(x, out, path, argc, argv, delay);
+    else
+        unpackOSC_output(x, out, path, argc, argv, x->x_schedule || depth == 0);
+}
+
+static int unpackOSC_matches(const t_unpackOSC_pattern *p, const char *address, size_t length)
+{
+/* Return non-zero if the padded address of length bytes is the same as the pattern,
+   or begins with the pattern followed by a slash. */
+    if (p->p_wild)
+    {
+        const char *end = (const char *)memchr(address, '\0', length);
+        return unpackOSC_wildmatch(p->p_bytes, address, (end)?end:address+length, 0);
+    }
+    if (length == p->p_size && memcmp(address, p->p_bytes, length) == 0) return 1;
+    return (length > p->p_length && address[p->p_length] == '/'
+        && memcmp(address, p->p_bytes, p->p_length) == 0);
+}
+
+static int unpackOSC_wildmatch(const char *pattern, const char *address, const char *end, int whole)
+{
+/* Return non-zero if the address up to end matches the pattern, or unless whole
+   is set, begins with something that does followed by a slash. No wildcard
+   matches a slash. */
+    const char *a = address, *close, *alt, *comma;
+
+    for (; *pattern; ++pattern, ++a)
+    {
+        switch (*pattern)
+        {
+            case '*':
+                while (pattern[1] == '*') pattern++;
+                for (;; ++a)
+                {
+                    if (unpackOSC_wildmatch(pattern+1, a, end, whole)) return 1;
+                    if (a == end || *a == '/') return 0;
+                }
+            case '?':
+                if (a == end || *a == '/') return 0;
+                break;
+            case '[':
+            {
+                int negate = (pattern[1] == '!'), found = 0;
+
+                if (a == end || *a == '/') return 0;
+                for (close = pattern+1+negate; *close && (*close != ']' || close == pattern+1+negate); ++close);
+                if (*close == '\0') return 0; /* no ] */
+                for (alt = pattern+1+negate; alt < close; ++alt)
+                {
+                    if (alt[1] == '-' && alt+2 < close)
+                    {
+                        if (*alt <= *a && *a <= alt[2]) found = 1;
+                        alt += 2;
+                    }
+                    else if (*alt == *a) found = 1;
+                }
+                if (found == negate) return 0;
+                pattern = close;
+                break;
             }
-            delta = OSCTT_getoffsetms(tt, now);
+            case '{':
+                if ((close = strchr(pattern, '}')) == NULL) return 0;
+                for (alt = pattern+1; alt <= close; alt = comma+1)
+                {
+                    size_t n;
+
+                    for (comma = alt; comma < close && *comma != ','; ++comma);
+                    n = comma-alt;
+                    if ((size_t)(end-a) >= n && memcmp(a, alt, n) == 0
+                        && unpackOSC_wildmatch(close+1, a+n, end, whole)) return 1;
+                }
+                return 0;
+            default:
+                if (a == end || *a != *pattern) return 0;
         }
-        outlet_float(x->x_delay_out, delta);
-        /* Note: if we wanted to actually use the time tag as a little-endian
-          64-bit int, we'd have to word-swap the two 32-bit halves of it */
+    }
+    return (a == end || (!whole && *a == '/'));
+}
+
+static int unpackOSC_before(const t_unpackOSC_event *a, const t_unpackOSC_event *b)
+{
+    return (a->e_time < b->e_time) || (a->e_time == b->e_time && a->e_seq < b->e_seq);
+}
 
-        while(i < argc)
+static void unpackOSC_schedule(t_unpackOSC *x, t_outlet *out, t_symbol *path, int argc, t_atom *argv, double delay)
+{
+/* queue a copy of a message to be output after delay milliseconds */
+    t_unpackOSC_event   e;
+    int                 i, parent;
+
+    if (delay < 0)
+    {
+        if (x->x_late == UNPACKOSC_LATE_DROP)
+        {
+            x->x_dropped++;
+            return;
+        }
+        if (x->x_late == UNPACKOSC_LATE_NOW)
+        {
+            unpackOSC_output(x, out, path, argc, argv, 1);
+            return;
+        }
+        delay = 0;
+    }
+    if (x->x_queuelength == x->x_queuesize)
+    {
+        int newsize = (x->x_queuesize)?2*x->x_queuesize:64;
+        t_unpackOSC_event *newqueue = (t_unpackOSC_event *)resizebytes(x->x_queue,
+            sizeof(t_unpackOSC_event)*x->x_queuesize, sizeof(t_unpackOSC_event)*newsize);
+        if (newqueue == NULL)
+        {
+            pd_error(x, "unpackOSC: unable to schedule %s", path->s_name);
+            return;
+        }
+        x->x_queue = newqueue;
+        x->x_queuesize = newsize;
+    }
+    e.e_time = clock_getsystimeafter(delay);
+    e.e_seq = x->x_seq++;
+    e.e_out = out;
+    e.e_path = path;
+    e.e_argc = argc;
+    e.e_argv = NULL;
+    if (argc)
+    {
+        if ((e.e_argv = (t_atom *)getbytes(sizeof(t_atom)*argc)) == NULL)
+        {
+            pd_error(x, "unpackOSC: unable to schedule %s", path->s_name);
+            return;
+        }
+        memcpy(e.e_argv, argv, sizeof(t_atom)*argc);
+    }
+    /* sift it up the heap */
+    for (i = x->x_queuelength++; i > 0; i = parent)
+    {
+        parent = (i-1)/2;
+        if (!unpackOSC_before(&e, &x->x_queue[parent])) break;
+        x->x_queue[i] = x->x_queue[parent];
+    }
+    x->x_queue[i] = e;
+    if (i == 0) clock_set(x->x_clock, e.e_time);
+}
+
+static void unpackOSC_pop(t_unpackOSC *x, t_unpackOSC_event *e)
+{
+/* take the earliest message off the queue */
+    t_unpackOSC_event   last;
+    int                 i, child, n = --x->x_queuelength;
+
+    *e = x->x_queue[0];
+    last = x->x_queue[n];
+    for (i = 0; (child = 2*i+1) < n; i = child)
+    {
+        if (child+1 < n && unpackOSC_before(&x->x_queue[child+1], &x->x_queue[child])) child++;
+        if (!unpackOSC_before(&x->x_queue[child], &last)) break;
+        x->x_queue[i] = x->x_queue[child];
+    }
+    x->x_queue[i] = last;
+}
+
+static void unpackOSC_tick(t_unpackOSC *x)
+{
+/* output everything that is due */
+    double              now = clock_getlogicaltime();
+    t_unpackOSC_event   e;
+
+    while (x->x_queuelength && x->x_queue[0].e_time <= now)
+    {
+        unpackOSC_pop(x, &e);
+        unpackOSC_output(x, e.e_out, e.e_path, e.e_argc, e.e_argv, 1);
+        if (e.e_argv != NULL) freebytes(e.e_argv, sizeof(t_atom)*e.e_argc);
+    }
+    if (x->x_queuelength) clock_set(x->x_clock, x->x_queue[0].e_time);
+}
+
+static void unpackOSC_flush(t_unpackOSC *x, int output)
+{
+/* empty the queue, outputting the messages in order if output is non-zero */
+    t_unpackOSC_event   e;
+
+    clock_unset(x->x_clock);
+    while (x->x_queuelength)
+    {
+        unpackOSC_pop(x, &e);
+        if (output) unpackOSC_output(x, e.e_out, e.e_path, e.e_argc, e.e_argv, 1);
+        if (e.e_argv != NULL) freebytes(e.e_argv, sizeof(t_atom)*e.e_argc);
+    }
+}
+
+static t_symbol *unpackOSC_gensym(t_unpackOSC *x, const char *string, size_t length)
+{
+/* Return the symbol for string, which is 4-byte aligned and padded with nulls
+   to length bytes. Short strings are looked up in the symbol cache by their
+   padded bytes, a word at a time, before asking gensym. */
+    const uint32_t          *words = (const uint32_t *)string;
+    t_unpackOSC_symcached   *c;
+    uint32_t                hash = 2166136261u;
+    size_t                  i, n = length/4;
+
+    if (x->x_symcache == NULL || length > UNPACKOSC_SYMCACHE_KEY)
+    {
+        x->x_symcache_misses++;
+        return gensym(string);
+    }
+    for (i = 0; i < n; ++i) hash = (hash ^ words[i])*16777619u; /* FNV-1a on words */
+    c = &x->x_symcache[(hash ^ (hash >> 16)) & (UNPACKOSC_SYMCACHE_SIZE-1)];
+    if (c->c_length == length)
+    {
+        for (i = 0; i < n && c->c_key[i] == words[i]; ++i);
+        if (i == n)
         {
-            int size = ntohl(*((int *) (buf + i)));
+            x->x_symcache_hits++;
+            return c->c_symbol;
+        }
+    }
+    x->x_symcache_misses++;
+    memcpy(c->c_key, string, length);
+    c->c_length = length;
+    c->c_symbol = gensym(string);
+    return c->c_symbol;
+}
+
+static double unpackOSC_timetagdelay(t_unpackOSC *x, const char *timetag)
+{
+/* convert the time tag at timetag into a millisecond delay from now */
+    OSCTimeTag tt, now;
+
+    debugprint("unpackOSC bundle timetag: [ %x.%0x\n", ntohl(*((uint32_t *)timetag)),
+        ntohl(*((uint32_t *)(timetag+4))));
+    tt.seconds = ntohl(*((uint32_t *)timetag));
+    tt.fraction = ntohl(*((uint32_t *)(timetag+4)));
+    if (tt.seconds == 0 && tt.fraction == 1) return 0; /* immediately */
+    if (x->x_use_pd_time)
+    {
+        double deltaref = clock_gettimesince(x->x_pd_timeref);
+        now = OSCTT_offsetms(x->x_pd_timetag, deltaref);
+    }
+    else now = OSCTT_Now();
+    return OSCTT_getoffsetms(tt, now);
+}
+
+static void unpackOSC_decode(t_unpackOSC *x, const char *buf, int length, t_unpackOSC_scratch *scratch)
+{
+/* Output the messages in the packet of length bytes at buf. Bundles are walked
+   with an explicit stack instead of recursion: each level holds the next element
+   of a bundle, its end and the delay from its time tag, and level 0 is the
+   packet itself. A bad element ends its bundle, the enclosing ones carry on. */
+    struct
+    {
+        const char  *next;
+        const char  *end;
+        double      delay;
+    } stack[MAX_BUNDLE_NESTING+1];
+    int depth = 0;
+
+    stack[0].next = buf;
+    stack[0].end = buf+length;
+    stack[0].delay = 0;
+    for (;;)
+    {
+        const char  *element;
+        int         size;
+
+        if (stack[depth].next >= stack[depth].end)
+        { /* the end of a bundle, or of the packet */
+            if (depth == 0) break;
+            debugprint("unpackOSC: bundle end ] depth is %d\n", depth);
+            if (x->x_markers) unpackOSC_marker(x, gensym("bundle_end"), depth, stack[depth].delay);
+            depth--;
+            /* anything left in the enclosing bundle has that bundle's delay */
+            if (!x->x_schedule && depth > 0 && stack[depth].next < stack[depth].end)
+                outlet_float(x->x_delay_out, stack[depth].delay);
+            continue;
+        }
+        if (depth == 0)
+        {
+            element = buf;
+            size = length;
+        }
+        else
+        {
+            size = ntohl(*((const int *)stack[depth].next));
             if ((size % 4) != 0)
             {
                 pd_error(x, "unpackOSC: Bad size count %d in bundle (not a multiple of 4)", size);
-                goto unpackOSC_list_out;
+                stack[depth].next = stack[depth].end;
+                continue;
             }
-            if ((size + i + 4) > argc)
+            if (size < 0 || size > stack[depth].end-stack[depth].next-4)
             {
                 pd_error(x, "unpackOSC: Bad size count %d in bundle (only %d bytes left in entire bundle)",
-                    size, argc-i-4);
-                goto unpackOSC_list_out;
+                    size, (int)(stack[depth].end-stack[depth].next-4));
+                stack[depth].next = stack[depth].end;
+                continue;
             }
+            element = stack[depth].next+4;
+        }
+        stack[depth].next = element+size;
+
+        if ((size >= 8) && (strncmp(element, "#bundle", 8) == 0))
+        { /* This is a bundle message. */
+            double delay;
 
-            /* Recursively handle element of bundle */
-            x->x_recursion_level++;
-            debugprint("unpackOSC: bundle depth %d\n", x->x_recursion_level);
-            if (x->x_recursion_level > MAX_BUNDLE_NESTING)
+            debugprint("unpackOSC: bundle msg:\n");
+            if (size < 16)
+            {
+                pd_error(x, "unpackOSC: Bundle message too small (%d bytes) for time tag", size);
+                continue;
+            }
+            if (depth == MAX_BUNDLE_NESTING)
             {
+                int i;
                 pd_error(x, "unpackOSC: bundle depth %d exceeded", MAX_BUNDLE_NESTING);
-                x->x_abort_bundle = 1;/* we need to back out of the recursive stack*/
-                goto unpackOSC_list_out;
+                /* drop the rest of the packet, closing the bundles that are open */
+                for (i = 0; i <= depth; ++i) stack[i].next = stack[i].end;
+                continue;
             }
-            debugprint("unpackOSC: bundle calling unpackOSC_list(x=%p, size=%d, buf[%d]=%p)\n",
-              x, size, i+4, &buf[i+4]);
-            unpackOSC_dolist(x, size, &buf[i+4], out_argv);
-            i += 4 + size;
+            delay = unpackOSC_timetagdelay(x, element+8);
+            if (delay > 0) x->x_early++;
+            else if (delay < 0) x->x_late_count++;
+            else x->x_ontime++;
+            if (!x->x_schedule) outlet_float(x->x_delay_out, delay);
+            depth++;
+            debugprint("unpackOSC: bundle depth %d\n", depth);
+            stack[depth].next = element+16; /* Skip "#bundle\0" and time tag */
+            stack[depth].end = element+size;
+            stack[depth].delay = delay;
+            if (x->x_markers) unpackOSC_marker(x, gensym("bundle_begin"), depth, delay);
         }
+        else if ((size == 24) && (strcmp(element, "#time") == 0))
+            post("unpackOSC: Time message: %s\n :).\n", element);
+        else /* This is not a bundle message or a time message */
+            unpackOSC_message(x, element, size, scratch, depth, stack[depth].delay);
+    }
+}
 
-        if (i != argc)
-        {
-            pd_error(x, "unpackOSC: This can't happen");
-        }
-
-        x->x_bundle_flag = 0; /* end of bundle */
-        debugprint("unpackOSC: bundle end ] depth is %d\n", x->x_recursion_level);
-
-    } else if ((argc == 24) && (strcmp(buf, "#time") == 0)) {
-        post("unpackOSC: Time message: %s\n :).\n", buf);
-        goto unpackOSC_list_out;
-    } else { /* This is not a bundle message or a time message */
-        int out_argc = 0; /* number of atoms to be output; atoms are stored in out_argv */
-        const char*messageName = buf;
-        int messageLen;
-        const char*args = unpackOSC_DataAfterAlignedString(x, messageName, buf+argc);
-        t_symbol *path;
-
-        debugprint("unpackOSC: message name string: %s length %d\n", messageName, argc);
-        if (args == 0)
+static void unpackOSC_message(t_unpackOSC *x, const char *buf, int n, t_unpackOSC_scratch *scratch, int depth, double delay)
+{
+/* decode the message of n bytes at buf into scratch and output it */
+    const char  *messageName = buf;
+    const char  *args = (n >= 4)?unpackOSC_DataAfterAlignedString(x, messageName, buf+n):NULL;
+    int         messageLen, out_argc = 0; /* number of atoms to be output */
+    int         j = 0;
+    t_symbol    *path, *receiver;
+    t_outlet    *out;
+    t_atom      *atoms = scratch->s_atoms, count;
+    t_unpackOSC_arraymap *m;
+
+    debugprint("unpackOSC: message name string: %s length %d\n", messageName, n);
+    if (args == 0)
+    {
+        pd_error(x, "unpackOSC: Bad message name string: Dropping entire message.");
+        return;
+    }
+    messageLen = args-messageName;
+    if (x->x_npatterns)
+    { /* find the first pattern it matches before decoding anything */
+        for (j = 0; j < x->x_npatterns; ++j)
+            if (unpackOSC_matches(&x->x_patterns[j], messageName, messageLen)) break;
+        if (j < x->x_npatterns) x->x_matched++;
+        else
         {
-            pd_error(x, "unpackOSC: Bad message name string: Dropping entire message.");
-            goto unpackOSC_list_out;
+            x->x_rejected++;
+            /* with dispatch a receiver may still want it */
+            if (!x->x_dispatch && !obj_starttraverseoutlet(&x->x_obj, &out, x->x_npatterns)) return;
         }
-        messageLen = args-messageName;
-        /* put the OSC path into a single symbol */
-        path = unpackOSC_path(x, messageName, messageLen); /* returns 0 if path failed  */
-        if (path == 0)
+    }
+    /* put the OSC path into a single symbol */
+    path = unpackOSC_path(x, messageName, messageLen); /* returns 0 if path failed  */
+    if (path == 0)
+    {
+        pd_error(x, "unpackOSC: Bad message path: Dropping entire message.");
+        return;
+    }
+    receiver = (x->x_dispatch)?unpackOSC_receiver(x, path):NULL; /* looked up once, also for scheduling */
+    if (x->x_npatterns && j == x->x_npatterns && receiver == NULL
+        && !obj_starttraverseoutlet(&x->x_obj, &out, x->x_npatterns))
+        return; /* rejected and nobody receives it, so don't decode it */
+    if (x->x_narrays && (m = unpackOSC_findarray(x, path, 1)) != NULL)
+    { /* the arguments go into an array, only their count is output */
+        int written = unpackOSC_toarray(x, m, args, n-messageLen);
+        if (written < 0) return;
+        SETFLOAT(&count, written);
+        atoms = &count;
+        out_argc = 1;
+    }
+    else
+    {
+        /* there are never more arguments than bytes */
+        if (scratch->s_size < (size_t)n)
         {
-            pd_error(x, "unpackOSC: Bad message path: Dropping entire message.");
-            goto unpackOSC_list_out;
+            atoms = (t_atom *)resizebytes(scratch->s_atoms,
+                sizeof(t_atom)*scratch->s_size, sizeof(t_atom)*n);
+            if (atoms == NULL)
+            {
+                pd_error(x, "unpackOSC: unable to allocate %lu bytes for %s", (long)(sizeof(t_atom)*n), path->s_name);
+                return;
+            }
+            scratch->s_atoms = atoms;
+            scratch->s_size = n;
         }
         debugprint("unpackOSC: message '%s', args=%p\n", path?path->s_name:0, args);
-        debugprint("unpackOSC_list calling unpackOSC_Smessage: message length %d\n", argc-messageLen);
-
-        unpackOSC_Smessage(x, out_argv, &out_argc, (void *)args, argc-messageLen);
-        if (0 == x->x_bundle_flag)
-            outlet_float(x->x_delay_out, 0); /* no delay for message not in a bundle */
-        outlet_anything(x->x_data_out, path, out_argc, out_argv);
+        debugprint("unpackOSC_message calling unpackOSC_Smessage: message length %d\n", n-messageLen);
+        unpackOSC_Smessage(x, scratch->s_atoms, &out_argc, (void *)args, n-messageLen);
+    }
+    if (receiver != NULL)
+        unpackOSC_deliver(x, NULL, receiver, out_argc, atoms, depth, delay); /* once, whichever outlets match */
+    else if (j == x->x_npatterns) /* no pattern matched, or there are none */
+        unpackOSC_deliver(x, x->x_data_out, path, out_argc, atoms, depth, delay);
+    else for (; j < x->x_npatterns; ++j)
+    {
+        if (unpackOSC_matches(&x->x_patterns[j], messageName, messageLen))
+            unpackOSC_deliver(x, x->x_patterns[j].p_out, path, out_argc, atoms, depth, delay);
     }
-    x->x_abort_bundle = 0;
-unpackOSC_list_out:
-    x->x_recursion_level = 0;
-    x->x_reentry_count--;
 }
 
+/* unpackOSC_list expects an OSC packet in the form of a list of floats on [0..255] */
 static void unpackOSC_list(t_unpackOSC *x, t_symbol *s, int argc, t_atom *argv)
 {
-    static t_atom out_atoms[MAX_MESG]; /* symbols making up the payload */
-    char raw[MAX_MESG];/* bytes making up the entire OSC message */
+    t_unpackOSC_scratch scratch = {NULL, 0}, *sp = &x->x_scratch;
+    char *raw; /* bytes making up the entire OSC packet, 4-byte aligned */
     int i;
     (void)s;
     if(!argc) {
@@ -285,34 +1031,61 @@ static void unpackOSC_list(t_unpackOSC *x, t_symbol *s, int argc, t_atom *argv)
         pd_error(x, "unpackOSC: Packet size (%d) greater than max (%d). Change MAX_MESG and recompile if you want more.", argc, MAX_MESG);
         return;
     }
-    /* copy the list to a byte buffer, checking for bytes only */
-    for (i = 0; i < argc; ++i)
+    if (x->x_reentry_count)
+    { /* we were called back from downstream while decoding: use our own buffers */
+        raw = (char *)getbytes(argc);
+        sp = &scratch;
+    }
+    else
     {
-        if (argv[i].a_type == A_FLOAT)
+        if (x->x_rawsize < (size_t)argc)
         {
-            int j = (int)argv[i].a_w.w_float;
-/*          if ((j == argv[i].a_w.w_float) && (j >= 0) && (j <= 255)) */
-/* this can miss bytes between 128 and 255 because they are interpreted somewhere as negative, */
-/* so change to this: */
-            if ((j == argv[i].a_w.w_float) && (j >= -128) && (j <= 255))
+            char *newraw = (char *)resizebytes(x->x_raw, x->x_rawsize, argc);
+            if (newraw != NULL)
             {
-                raw[i] = (char)j;
-            }
-            else
-            {
-                pd_error(x, "unpackOSC: Data[%d] out of range (%d), dropping packet",
-                         i, (int)argv[i].a_w.w_float);
-                return;
+                x->x_raw = newraw;
+                x->x_rawsize = argc;
             }
         }
+        raw = (x->x_rawsize < (size_t)argc)?NULL:x->x_raw;
+    }
+    if (raw == NULL)
+    {
+        pd_error(x, "unpackOSC: unable to allocate %d bytes for packet", argc);
+        return;
+    }
+    /* copy the list to a byte buffer, checking for bytes only */
+    i = OSC_atomsToBytes((unsigned char *)raw, argv, argc);
+    if (i >= 0)
+    {
+        if (argv[i].a_type == A_FLOAT)
+            pd_error(x, "unpackOSC: Data[%d] out of range (%g), dropping packet",
+                     i, argv[i].a_w.w_float);
         else
-        {
             pd_error(x, "unpackOSC: Data[%d] not float, dropping packet", i);
-            return;
-        }
+        goto unpackOSC_list_out;
     }
 
-    unpackOSC_dolist(x, argc, raw, out_atoms);
+    if (x->x_strict)
+    {
+        const char *where = raw;
+        const char *problem = unpackOSC_validate(raw, argc, 0, &where);
+        if (problem != NULL)
+        {
+            x->x_malformed++;
+            pd_error(x, "unpackOSC: %s at byte %d, dropping packet", problem, (int)(where-raw));
+            goto unpackOSC_list_out;
+        }
+    }
+    x->x_reentry_count++;
+    unpackOSC_decode(x, raw, argc, sp);
+    x->x_reentry_count--;
+unpackOSC_list_out:
+    if (sp == &scratch)
+    {
+        freebytes(raw, argc);
+        if (scratch.s_atoms != NULL) freebytes(scratch.s_atoms, sizeof(t_atom)*scratch.s_size);
+    }
 }
 
 static t_symbol*unpackOSC_path(t_unpackOSC *x, const char *path, size_t len)
@@ -334,7 +1107,7 @@ static t_symbol*unpackOSC_path(t_unpackOSC *x, const char *path, size_t len)
     {
         if (path[i] == '\0')
         { /* the end of the path: turn path into a symbol */
-            return gensym(path);
+            return unpackOSC_gensym(x, path, len);
         }
     }
     pd_error(x, "unpackOSC: Path too long, dropping message");
@@ -394,6 +1167,13 @@ static void unpackOSC_PrintTypeTaggedArgs(t_unpackOSC *x, t_atom *data_at, int *
     if (p == NULL) return; /* malformed message */
     for (thisType = typeTags + 1; *thisType != 0; ++thisType)
     {
+        /* don't read past the end of the message, or write more atoms than it has bytes */
+        size_t needed = (strchr("bmircf", *thisType))?4:(strchr("htd", *thisType))?8:0;
+        if ((size_t)(typeTags+n-p) < needed)
+        {
+            pd_error(x, "unpackOSC: PrintTypeTaggedArgs: no argument for type tag %c", *thisType);
+            return;
+        }
         switch (*thisType)
         {
             case 'b': /* blob: an int32 size count followed by that many 8-bit bytes */
@@ -401,8 +1181,15 @@ static void unpackOSC_PrintTypeTaggedArgs(t_unpackOSC *x, t_atom *data_at, int *
                 int i, blob_bytes = ntohl(*((int *) p));
                 debugprint("blob: %u bytes\n", blob_bytes);
                 p += 4;
-                for (i = 0; i < blob_bytes; ++i, ++p, ++myargc)
-                    SETFLOAT(mya+myargc,(*(unsigned char *)p));
+                if (blob_bytes > typeTags+n-p)
+                {
+                    pd_error(x, "unpackOSC: PrintTypeTaggedArgs: blob of %d bytes is longer than the message", blob_bytes);
+                    return;
+                }
+                i = (blob_bytes > 0)?blob_bytes:0;
+                OSC_bytesToAtoms(mya+myargc, (const unsigned char *)p, i);
+                p += i;
+                myargc += i;
                 while (i%4)
                 {
                     ++i;
@@ -435,15 +1222,35 @@ static void unpackOSC_PrintTypeTaggedArgs(t_unpackOSC *x, t_atom *data_at, int *
                 break;
             }
             case 'h': case 't':
-                debugprint("[A 64-bit int]\n");
-                pd_error(x, "unpackOSC: PrintTypeTaggedArgs: [A 64-bit int] not implemented");
+            {
+                uint32_t hi = ntohl(*((uint32_t *) p)), lo = ntohl(*((uint32_t *) (p+4)));
+                debugprint("%s: 0x%08X%08X\n", (*thisType == 'h')?"int64":"timetag", hi, lo);
+#if PD_FLOATSIZE == 64
+                /* h is an integer, t is seconds since 1900 */
+                if (*thisType == 'h') SETFLOAT(mya+myargc, (t_float)(int64_t)(((uint64_t)hi << 32) | lo));
+                else SETFLOAT(mya+myargc, hi + lo/4294967296.0);
+                myargc++;
+#else
+                /* a 32-bit float can't hold 64 bits, so output four 16-bit pieces */
+                SETFLOAT(mya+myargc, (*thisType == 'h')?(t_float)(int16_t)(hi >> 16):(t_float)(hi >> 16));
+                SETFLOAT(mya+myargc+1, (t_float)(hi & 0xFFFF));
+                SETFLOAT(mya+myargc+2, (t_float)(lo >> 16));
+                SETFLOAT(mya+myargc+3, (t_float)(lo & 0xFFFF));
+                myargc += 4;
+#endif
                 p += 8;
                 break;
+            }
             case 'd':
-                debugprint("[A 64-bit float]\n");
-                pd_error(x, "unpackOSC: PrintTypeTaggedArgs: [A 64-bit float] not implemented");
+            {
+                intfloat64 thisif;
+                thisif.i = ((uint64_t)ntohl(*((uint32_t *) p)) << 32) | ntohl(*((uint32_t *) (p+4)));
+                debugprint("double: %f\n", thisif.d);
+                SETFLOAT(mya+myargc, (t_float)thisif.d);
+                myargc++;
                 p += 8;
                 break;
+            }
             case 's': case 'S':
                 if (!unpackOSC_IsNiceString(x, p, typeTags+n))
                 {
@@ -452,11 +1259,11 @@ static void unpackOSC_PrintTypeTaggedArgs(t_unpackOSC *x, t_atom *data_at, int *
                 }
                 else
                 {
+                    const char *next = unpackOSC_DataAfterAlignedString(x, p, typeTags+n);
                     debugprint("string: \"%s\"\n", p);
-                    SETSYMBOL(mya+myargc,gensym(p));
+                    SETSYMBOL(mya+myargc, unpackOSC_gensym(x, p, next-p));
                     myargc++;
-                    p = unpackOSC_DataAfterAlignedString(x, p, typeTags+n);
-
+                    p = next;
                 }
                 break;
             case 'T':
@@ -526,7 +1333,7 @@ static void unpackOSC_PrintHeuristicallyTypeGuessedArgs(t_unpackOSC *x, t_atom *
         {
             nextString = unpackOSC_DataAfterAlignedString(x, string, chars+n);
             debugprint("\"%s\" ", (i == 0 && skipComma) ? string +1 : string);
-            SETSYMBOL(mya+myargc,gensym(string));
+            SETSYMBOL(mya+myargc, unpackOSC_gensym(x, string, nextString-string));
             myargc++;
             i += (nextString-string) / 4;
         }
@@ -540,6 +1347,84 @@ static void unpackOSC_PrintHeuristicallyTypeGuessedArgs(t_unpackOSC *x, t_atom *
     }
 }
 
+static const char *unpackOSC_stringend(const char *string, const char *end)
+{
+/* Return the end of the null-padded string at string, or NULL
+   if it isn't one or runs past end. Reports no errors. */
+    const char *nul = memchr(string, '\0', end-string);
+    const char *p;
+
+    if (nul == NULL) return NULL;
+    p = string + (((nul-string)+4) & ~3);
+    if (p > end) return NULL;
+    for (++nul; nul < p; ++nul) if (*nul != '\0') return NULL;
+    return p;
+}
+
+static const char *unpackOSC_validate(const char *buf, int n, int depth, const char **where)
+{
+/* Check the structure of the packet of n bytes at buf in one pass, without
+   decoding it: bundle element sizes, string padding, and that the arguments
+   fill the message exactly as its type tags say. Returns NULL if it is well
+   formed, otherwise what is wrong, with *where pointing at it. */
+    const char  *end = buf+n, *p, *tags, *t;
+    int         size;
+
+    *where = buf;
+    if (n % 4) return "size not a multiple of 4";
+    if (n >= 8 && strncmp(buf, "#bundle", 8) == 0)
+    {
+        if (n < 16) return "bundle too small for time tag";
+        if (depth >= MAX_BUNDLE_NESTING) return "bundles nested too deep";
+        for (p = buf+16; p < end; p += 4+size)
+        {
+            const char *problem;
+
+            *where = p;
+            size = ntohl(*((const uint32_t *)p));
+            if (size <= 0 || size % 4 || size > end-p-4) return "bad bundle element size";
+            if ((problem = unpackOSC_validate(p+4, size, depth+1, where)) != NULL) return problem;
+        }
+        return NULL;
+    }
+    if (n == 24 && memcmp(buf, "#time", 6) == 0) return NULL;
+    if (n == 0 || buf[0] != '/' || (p = unpackOSC_stringend(buf, end)) == NULL) return "bad address";
+    if (p == end || p[0] != ',' || p[1] == ',') return NULL; /* no type tags: anything goes */
+    tags = p;
+    if ((p = unpackOSC_stringend(tags, end)) == NULL) return "bad type tags";
+    for (t = tags+1; *t != '\0'; ++t)
+    {
+        *where = p;
+        switch (*t)
+        {
+            case 'b':
+                if (end-p < 4) return "arguments missing";
+                size = ntohl(*((const uint32_t *)p));
+                if (size < 0 || size > end-p-4) return "bad blob size";
+                p += 4 + ((size+3) & ~3);
+                break;
+            case 'i': case 'r': case 'c': case 'f': case 'm':
+                if (end-p < 4) return "arguments missing";
+                p += 4;
+                break;
+            case 'h': case 't': case 'd':
+                if (end-p < 8) return "arguments missing";
+                p += 8;
+                break;
+            case 's': case 'S':
+                if ((p = unpackOSC_stringend(p, end)) == NULL) return "bad string";
+                break;
+            case 'T': case 'F': case 'N': case 'I':
+                break;
+            default:
+                return "unrecognized type tag";
+        }
+    }
+    *where = p;
+    if (p != end) return "more arguments than type tags";
+    return NULL;
+}
+
 #define STRING_ALIGN_PAD 4
 
 static const char *unpackOSC_DataAfterAlignedString(t_unpackOSC *x, const char *string, const char *boundary)